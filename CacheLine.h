@@ -0,0 +1,65 @@
+#ifndef CACHELINE_H_
+#define CACHELINE_H_
+//------------------------------------------------------------------------------
+//
+// Project: Hack2018
+// Module: CacheLine
+// File: CacheLine.h
+//
+//------------------------------------------------------------------------------
+/// @file
+/// @brief This file contains the cache line size and the CacheAligned base
+/// shared by the classes that keep their hot members on lines of their own.
+///
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// System include files.
+//------------------------------------------------------------------------------
+#include <new>
+#include <stddef.h>
+#include <stdlib.h>
+
+//------------------------------------------------------------------------------
+// Project include files.
+//------------------------------------------------------------------------------
+
+/// @brief Size of a cache line, used for slot alignment and to keep members
+/// written by different threads apart.
+const size_t CACHE_LINE_SIZE = 64;
+
+//------------------------------------------------------------------------------
+//
+class CacheAligned
+//
+/// @brief This class gives heap instances of the classes derived from it the
+/// cache-line alignment of their members, which a plain new expression only
+/// honours from C++17 on.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    static void* operator new(size_t size)
+    {
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, CACHE_LINE_SIZE, size) != 0)
+        {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    static void operator delete(void* ptr)
+    {
+        free(ptr);
+    }
+};
+
+//------------------------------------------------------------------------------
+// End of file
+//------------------------------------------------------------------------------
+#endif // CACHELINE_H_
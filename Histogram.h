@@ -0,0 +1,183 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+//------------------------------------------------------------------------------
+//
+// Project: Hack2018
+// Module: Histogram
+// File: Histogram.h
+//
+//------------------------------------------------------------------------------
+/// @file
+/// @brief This file contains the LatencyHistogram class.
+/// The histogram records nanosecond durations in log-linear buckets, in the
+/// manner of HdrHistogram, with a fixed relative error and no allocation.
+///
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// System include files.
+//------------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Project include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//
+class LatencyHistogram
+//
+/// @brief This class counts durations in buckets whose width doubles with
+/// every power of two, each power split into SUB_BUCKETS linear steps. Values
+/// below SUB_BUCKETS ns are exact; above that a value is reported within
+/// 1/SUB_BUCKETS (about 3%) of its true size. Values of 2^MAX_EXPONENT ns
+/// (about 18 minutes) and more fall into the last bucket.
+///
+/// Record() is for a single writer thread and costs a few instructions and
+/// one relaxed store; any thread may read the percentiles. A reader racing the
+/// writer may see a count and sum that are a few records apart.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    static const unsigned int SUB_BUCKET_BITS = 5;
+    static const unsigned int SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+    static const unsigned int MAX_EXPONENT = 40;
+    static const size_t BUCKETS = SUB_BUCKETS * (MAX_EXPONENT - SUB_BUCKET_BITS + 2);
+
+    LatencyHistogram()
+        :
+        m_buckets(new std::atomic<uint64_t>[BUCKETS]),
+        m_count(0),
+        m_sumNs(0),
+        m_maxNs(0)
+    {
+        for (size_t i = 0; i < BUCKETS; ++i)
+        {
+            m_buckets[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    LatencyHistogram( const LatencyHistogram& ) = delete;
+    LatencyHistogram( LatencyHistogram&& ) = delete;
+    LatencyHistogram& operator=( LatencyHistogram&& ) = delete;
+    LatencyHistogram& operator=( const LatencyHistogram& ) = delete;
+
+    /// @brief Counts one duration. Writer thread only.
+    void Record(uint64_t valueNs)
+    {
+        Bump(m_buckets[Index(valueNs)], 1);
+        Bump(m_count, 1);
+        Bump(m_sumNs, valueNs);
+        if (valueNs > m_maxNs.load(std::memory_order_relaxed))
+        {
+            m_maxNs.store(valueNs, std::memory_order_relaxed);
+        }
+    }
+
+    /// @brief Obtains the number of durations recorded.
+    uint64_t Count() const
+    {
+        return m_count.load(std::memory_order_relaxed);
+    }
+
+    /// @brief Obtains the total of the durations recorded.
+    uint64_t SumNs() const
+    {
+        return m_sumNs.load(std::memory_order_relaxed);
+    }
+
+    /// @brief Obtains the longest duration recorded, exactly.
+    uint64_t MaxNs() const
+    {
+        return m_maxNs.load(std::memory_order_relaxed);
+    }
+
+    /// @brief Finds the durations at several quantiles in one pass.
+    /// @param quantiles the quantiles to find, ascending, each in [0, 1].
+    /// @param count the number of quantiles.
+    /// @param out receives, for each quantile, the highest value equivalent
+    /// to the bucket it falls in (capped at the maximum); 0 if empty.
+    void Percentiles(const double* quantiles, size_t count, uint64_t* out) const
+    {
+        uint64_t total = 0;
+        std::unique_ptr<uint64_t[]> snapshot(new uint64_t[BUCKETS]);
+        for (size_t i = 0; i < BUCKETS; ++i)
+        {
+            snapshot[i] = m_buckets[i].load(std::memory_order_relaxed);
+            total += snapshot[i];
+        }
+
+        const uint64_t maxNs = MaxNs();
+        uint64_t seen = 0;
+        size_t bucket = 0;
+        for (size_t q = 0; q < count; ++q)
+        {
+            if (total == 0)
+            {
+                out[q] = 0;
+                continue;
+            }
+            // Rank of the quantile, 1-based, rounded up
+            uint64_t rank = static_cast<uint64_t>(quantiles[q] * total + 0.999999);
+            rank = rank ? rank : 1;
+            while (bucket < BUCKETS && seen + snapshot[bucket] < rank)
+            {
+                seen += snapshot[bucket++];
+            }
+            out[q] = (bucket < BUCKETS) ? std::min(HighestEquivalent(bucket), maxNs) : maxNs;
+        }
+    }
+
+protected:
+    static void Bump(std::atomic<uint64_t>& value, uint64_t n)
+    {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static size_t Index(uint64_t valueNs)
+    {
+        if (valueNs < SUB_BUCKETS)
+        {
+            return static_cast<size_t>(valueNs);
+        }
+        unsigned int exponent = 63 - __builtin_clzll(valueNs);
+        if (exponent > MAX_EXPONENT)
+        {
+            return BUCKETS - 1;
+        }
+        unsigned int shift = exponent - SUB_BUCKET_BITS;
+        size_t sub = static_cast<size_t>(valueNs >> shift) - SUB_BUCKETS;
+        return SUB_BUCKETS + static_cast<size_t>(shift) * SUB_BUCKETS + sub;
+    }
+
+    static uint64_t HighestEquivalent(size_t index)
+    {
+        if (index < SUB_BUCKETS)
+        {
+            return index;
+        }
+        unsigned int shift = static_cast<unsigned int>((index - SUB_BUCKETS) / SUB_BUCKETS);
+        uint64_t sub = (index - SUB_BUCKETS) % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << shift) - 1;
+    }
+
+    std::unique_ptr<std::atomic<uint64_t>[]> m_buckets;
+    std::atomic<uint64_t>                    m_count;
+    std::atomic<uint64_t>                    m_sumNs;
+    std::atomic<uint64_t>                    m_maxNs;
+};
+
+//------------------------------------------------------------------------------
+// End of file
+//------------------------------------------------------------------------------
+#endif // HISTOGRAM_H_
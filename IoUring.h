@@ -0,0 +1,494 @@
+#ifndef IOURING_H_
+#define IOURING_H_
+//------------------------------------------------------------------------------
+//
+// Project: Hack2018
+// Module: IoUring
+// File: IoUring.h
+//
+//------------------------------------------------------------------------------
+/// @file
+/// @brief This file contains the IoUring and IoBufferRing classes.
+/// They are a minimal io_uring binding made directly on the system calls, so
+/// that no liburing is needed.
+///
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// System include files.
+//------------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <system_error>
+#include <vector>
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+//------------------------------------------------------------------------------
+// Project include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//
+class IoHandler
+//
+/// @brief This interface receives the completions of the operations that
+/// were queued under its IoUring::Register() id.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    virtual ~IoHandler() {}
+
+    /// @brief Called once per completion queue entry.
+    /// @param tag the tag given to IoUring::GetSqe().
+    /// @param result the operation result, a negative errno on failure.
+    /// @param flags the IORING_CQE_F_* flags.
+    virtual void OnCompletion(uint32_t tag, int32_t result, uint32_t flags) = 0;
+};
+
+//------------------------------------------------------------------------------
+//
+class IoUring
+//
+/// @brief This class owns one io_uring instance. Submission queue entries
+/// are staged with GetSqe() and handed to the kernel in a single system call
+/// by Submit() or Wait(). Completions are routed to the IoHandler the entry
+/// was queued for; the user_data of every entry carries the handler id in
+/// its upper half and a handler-defined tag in the lower half.
+///
+/// The class is not thread safe; it is meant to be driven by one event loop
+/// thread.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    /// @brief Constructor.
+    /// @param entries the submission queue size, a power of two.
+    /// @throw std::system_error if the kernel has no usable io_uring.
+    explicit IoUring(unsigned int entries)
+        :
+        m_fd(-1),
+        m_sqMap(nullptr),
+        m_sqMapSize(0),
+        m_cqMap(nullptr),
+        m_cqMapSize(0),
+        m_sqes(nullptr),
+        m_sqesSize(0),
+        m_sqTail(0),
+        m_sqFlushed(0),
+        m_handlers()
+    {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_COOP_TASKRUN;
+        m_fd = Setup(entries, params);
+        if (m_fd < 0 && errno == EINVAL)
+        {
+            // Older kernel; cooperative task running is only an optimisation
+            memset(&params, 0, sizeof(params));
+            m_fd = Setup(entries, params);
+        }
+        if (m_fd < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+        }
+        if (!(params.features & IORING_FEAT_EXT_ARG))
+        {
+            close(m_fd);
+            throw std::system_error(ENOSYS, std::generic_category(), "io_uring wait timeouts");
+        }
+
+        m_sqMapSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        m_cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            m_sqMapSize = m_cqMapSize = std::max(m_sqMapSize, m_cqMapSize);
+        }
+        m_sqMap = Map(m_sqMapSize, IORING_OFF_SQ_RING);
+        m_cqMap = (params.features & IORING_FEAT_SINGLE_MMAP) ? m_sqMap : Map(m_cqMapSize, IORING_OFF_CQ_RING);
+        m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        m_sqes = static_cast<struct io_uring_sqe*>(Map(m_sqesSize, IORING_OFF_SQES));
+
+        unsigned char* sq = static_cast<unsigned char*>(m_sqMap);
+        m_sqHead = reinterpret_cast<std::atomic<uint32_t>*>(sq + params.sq_off.head);
+        m_sqTailShared = reinterpret_cast<std::atomic<uint32_t>*>(sq + params.sq_off.tail);
+        m_sqMask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+        m_sqEntries = params.sq_entries;
+        // Entries are used in ring order, so the indirection array is fixed
+        uint32_t* array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+        for (uint32_t i = 0; i < m_sqEntries; ++i)
+        {
+            array[i] = i;
+        }
+
+        unsigned char* cq = static_cast<unsigned char*>(m_cqMap);
+        m_cqHead = reinterpret_cast<std::atomic<uint32_t>*>(cq + params.cq_off.head);
+        m_cqTail = reinterpret_cast<std::atomic<uint32_t>*>(cq + params.cq_off.tail);
+        m_cqMask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    ~IoUring()
+    {
+        munmap(m_sqes, m_sqesSize);
+        if (m_cqMap != m_sqMap)
+        {
+            munmap(m_cqMap, m_cqMapSize);
+        }
+        munmap(m_sqMap, m_sqMapSize);
+        close(m_fd);
+    }
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    IoUring( const IoUring& ) = delete;
+    IoUring( IoUring&& ) = delete;
+    IoUring& operator=( IoUring&& ) = delete;
+    IoUring& operator=( const IoUring& ) = delete;
+
+    /// @brief Handler id for entries whose completions are not wanted.
+    static const uint32_t NO_HANDLER = 0xffffffff;
+
+    /// @brief Adds a completion handler.
+    /// @return the id to pass to GetSqe().
+    uint32_t Register(IoHandler& handler)
+    {
+        m_handlers.push_back(&handler);
+        return static_cast<uint32_t>(m_handlers.size() - 1);
+    }
+
+    /// @brief Stages a zeroed submission queue entry. If the queue is full,
+    /// the staged entries are submitted first.
+    /// @param handlerId the id of the handler that receives the completion.
+    /// @param tag a value passed back to the handler with the completion.
+    /// @return the entry, or nullptr if the kernel is not consuming entries.
+    struct io_uring_sqe* GetSqe(uint32_t handlerId, uint32_t tag)
+    {
+        if (m_sqTail - m_sqHead->load(std::memory_order_acquire) == m_sqEntries)
+        {
+            Submit();
+            if (m_sqTail - m_sqHead->load(std::memory_order_acquire) == m_sqEntries)
+            {
+                return nullptr;
+            }
+        }
+        struct io_uring_sqe* sqe = &m_sqes[m_sqTail & m_sqMask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->user_data = (static_cast<uint64_t>(handlerId) << 32) | tag;
+        ++m_sqTail;
+        return sqe;
+    }
+
+    /// @brief Hands every staged entry to the kernel without waiting.
+    /// @return the number of entries submitted, or a negative errno.
+    int Submit()
+    {
+        return Enter(0, nullptr);
+    }
+
+    /// @brief Hands every staged entry to the kernel and has it post any
+    /// completions it has pending, without waiting. A spinning caller needs
+    /// this, as task work deferred to it (IORING_SETUP_COOP_TASKRUN) only
+    /// runs when it enters the kernel.
+    /// @return the number of entries submitted, or a negative errno.
+    int Poll()
+    {
+        return Enter(0, nullptr, true);
+    }
+
+    /// @brief Hands every staged entry to the kernel and waits until at
+    /// least one completion is available or the timeout expires.
+    /// @param timeoutNs the longest time to wait.
+    /// @return the number of entries submitted, or a negative errno
+    /// (-ETIME on timeout).
+    int Wait(uint64_t timeoutNs)
+    {
+        struct __kernel_timespec ts;
+        ts.tv_sec = timeoutNs / 1000000000ull;
+        ts.tv_nsec = timeoutNs % 1000000000ull;
+        return Enter(1, &ts);
+    }
+
+    /// @brief Passes every available completion to its handler.
+    /// @return the number of completions handled.
+    unsigned int Dispatch()
+    {
+        unsigned int count = 0;
+        uint32_t head = m_cqHead->load(std::memory_order_relaxed);
+        while (head != m_cqTail->load(std::memory_order_acquire))
+        {
+            // Copy out, then release the slot before the handler queues more
+            struct io_uring_cqe cqe = m_cqes[head & m_cqMask];
+            m_cqHead->store(++head, std::memory_order_release);
+            uint32_t handlerId = static_cast<uint32_t>(cqe.user_data >> 32);
+            if (handlerId < m_handlers.size())
+            {
+                m_handlers[handlerId]->OnCompletion(static_cast<uint32_t>(cqe.user_data), cqe.res, cqe.flags);
+            }
+            ++count;
+        }
+        return count;
+    }
+
+    /// @brief Obtains the ring file descriptor, for io_uring_register().
+    int Fd() const
+    {
+        return m_fd;
+    }
+
+protected:
+    static int Setup(unsigned int entries, struct io_uring_params& params)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    }
+
+    void* Map(size_t size, off_t offset)
+    {
+        void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+        if (map == MAP_FAILED)
+        {
+            int error = errno;
+            close(m_fd);
+            throw std::system_error(error, std::generic_category(), "io_uring mmap");
+        }
+        return map;
+    }
+
+    int Enter(unsigned int minComplete, struct __kernel_timespec* ts, bool getEvents = false)
+    {
+        m_sqTailShared->store(m_sqTail, std::memory_order_release);
+        unsigned int toSubmit = m_sqTail - m_sqFlushed;
+        m_sqFlushed = m_sqTail;
+
+        unsigned int flags = 0;
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        if (minComplete || getEvents)
+        {
+            flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+            arg.sigmask_sz = _NSIG / 8;
+            arg.ts = reinterpret_cast<uint64_t>(ts);
+        }
+        int status = static_cast<int>(syscall(__NR_io_uring_enter, m_fd, toSubmit, minComplete, flags,
+                                              flags ? &arg : nullptr, sizeof(arg)));
+        return status < 0 ? -errno : status;
+    }
+
+    int                          m_fd;
+    void*                        m_sqMap;
+    size_t                       m_sqMapSize;
+    void*                        m_cqMap;
+    size_t                       m_cqMapSize;
+    struct io_uring_sqe*         m_sqes;
+    size_t                       m_sqesSize;
+    std::atomic<uint32_t>*       m_sqHead;
+    std::atomic<uint32_t>*       m_sqTailShared;
+    uint32_t                     m_sqMask;
+    uint32_t                     m_sqEntries;
+    uint32_t                     m_sqTail;
+    uint32_t                     m_sqFlushed;
+    std::atomic<uint32_t>*       m_cqHead;
+    std::atomic<uint32_t>*       m_cqTail;
+    uint32_t                     m_cqMask;
+    struct io_uring_cqe*         m_cqes;
+    std::vector<IoHandler*>      m_handlers;
+};
+
+//------------------------------------------------------------------------------
+//
+class IoBufferRing
+//
+/// @brief This class is a group of receive buffers lent to the kernel, which
+/// picks one per datagram for IOSQE_BUFFER_SELECT operations. A completion
+/// names the buffer it used by its 16-bit buffer id; the owner hands the
+/// buffer back, or a replacement under the same id, with Add() and Publish().
+///
+/// The group is a provided buffer ring (IORING_REGISTER_PBUF_RING) shared
+/// with the kernel where that works, as checked by Probe(). Otherwise each
+/// buffer is handed over with its own IORING_OP_PROVIDE_BUFFERS entry, which
+/// costs a submission queue entry per buffer but no extra system calls.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    /// @brief Constructor.
+    /// @param ring the io_uring the buffers are used with.
+    /// @param groupId the buffer group id used in IOSQE_BUFFER_SELECT entries.
+    /// @param entries the number of buffers, a power of two up to 32768.
+    /// @param shared true for a provided buffer ring, false to provide
+    /// buffers one entry at a time.
+    /// @throw std::system_error if the ring cannot be registered.
+    IoBufferRing(IoUring& ring, uint16_t groupId, uint16_t entries, bool shared)
+        :
+        m_ring(ring),
+        m_groupId(groupId),
+        m_entries(entries),
+        m_mask(entries - 1),
+        m_mapSize(entries * sizeof(struct io_uring_buf)),
+        m_bufs(nullptr),
+        m_tail(0)
+    {
+        if (!shared)
+        {
+            return;
+        }
+
+        void* map = mmap(nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED)
+        {
+            throw std::system_error(errno, std::generic_category(), "buffer ring mmap");
+        }
+        m_bufs = static_cast<struct io_uring_buf_ring*>(map);
+
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(m_bufs);
+        reg.ring_entries = entries;
+        reg.bgid = groupId;
+        if (syscall(__NR_io_uring_register, m_ring.Fd(), IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        {
+            int error = errno;
+            munmap(m_bufs, m_mapSize);
+            throw std::system_error(error, std::generic_category(), "IORING_REGISTER_PBUF_RING");
+        }
+    }
+
+    ~IoBufferRing()
+    {
+        if (m_bufs == nullptr)
+        {
+            return;
+        }
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = m_groupId;
+        syscall(__NR_io_uring_register, m_ring.Fd(), IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(m_bufs, m_mapSize);
+    }
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    IoBufferRing( const IoBufferRing& ) = delete;
+    IoBufferRing( IoBufferRing&& ) = delete;
+    IoBufferRing& operator=( IoBufferRing&& ) = delete;
+    IoBufferRing& operator=( const IoBufferRing& ) = delete;
+
+    /// @brief Checks that the kernel both accepts provided buffer rings
+    /// (Linux 5.19) and actually selects buffers from them, by reading a byte
+    /// from a pipe through a one-entry ring on a scratch io_uring.
+    static bool Probe()
+    {
+        struct Result : public IoHandler
+        {
+            void OnCompletion(uint32_t, int32_t result, uint32_t flags) override
+            {
+                ok = result == 1 && (flags & IORING_CQE_F_BUFFER);
+            }
+            bool ok = false;
+        } result;
+
+        int fds[2];
+        if (pipe(fds) < 0)
+        {
+            return false;
+        }
+        try
+        {
+            IoUring ring{4};
+            uint32_t id = ring.Register(result);
+            IoBufferRing buffers{ring, 0, 1, true};
+            unsigned char byte = 0;
+            buffers.Add(&byte, 1, 0);
+            buffers.Publish();
+            if (write(fds[1], &byte, 1) == 1)
+            {
+                struct io_uring_sqe* sqe = ring.GetSqe(id, 0);
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = fds[0];
+                sqe->flags = IOSQE_BUFFER_SELECT;
+                sqe->buf_group = 0;
+                sqe->len = 1;
+                ring.Wait(100000000);
+                ring.Dispatch();
+            }
+        }
+        catch (const std::system_error&)
+        {
+        }
+        close(fds[0]);
+        close(fds[1]);
+        return result.ok;
+    }
+
+    /// @brief Stages a buffer. It becomes available to the kernel on
+    /// Publish(), or with the next submission if the ring is not shared.
+    /// @return false if no submission queue entry was free.
+    bool Add(void* addr, uint32_t len, uint16_t bufferId)
+    {
+        if (m_bufs == nullptr)
+        {
+            struct io_uring_sqe* sqe = m_ring.GetSqe(IoUring::NO_HANDLER, 0);
+            if (sqe == nullptr)
+            {
+                return false;
+            }
+            sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+            sqe->fd = 1;
+            sqe->addr = reinterpret_cast<uint64_t>(addr);
+            sqe->len = len;
+            sqe->off = bufferId;
+            sqe->buf_group = m_groupId;
+            return true;
+        }
+
+        struct io_uring_buf& buf = m_bufs->bufs[m_tail & m_mask];
+        buf.addr = reinterpret_cast<uint64_t>(addr);
+        buf.len = len;
+        buf.bid = bufferId;
+        ++m_tail;
+        return true;
+    }
+
+    /// @brief Makes every staged buffer available to the kernel.
+    void Publish()
+    {
+        if (m_bufs != nullptr)
+        {
+            reinterpret_cast<std::atomic<uint16_t>*>(&m_bufs->tail)->store(m_tail, std::memory_order_release);
+        }
+    }
+
+    uint16_t GroupId() const
+    {
+        return m_groupId;
+    }
+
+    uint16_t Entries() const
+    {
+        return m_entries;
+    }
+
+protected:
+    IoUring&                  m_ring;
+    const uint16_t            m_groupId;
+    const uint16_t            m_entries;
+    const uint16_t            m_mask;
+    const size_t              m_mapSize;
+    struct io_uring_buf_ring* m_bufs;
+    uint16_t                  m_tail;
+};
+
+//------------------------------------------------------------------------------
+// End of file
+//------------------------------------------------------------------------------
+#endif // IOURING_H_
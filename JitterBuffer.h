@@ -0,0 +1,212 @@
+#ifndef JITTERBUFFER_H_
+#define JITTERBUFFER_H_
+//------------------------------------------------------------------------------
+//
+// Project: Hack2018
+// Module: JitterBuffer
+// File: JitterBuffer.h
+//
+//------------------------------------------------------------------------------
+/// @file
+/// @brief This file contains the JitterBuffer class template.
+/// The buffer is a fixed-capacity ring indexed directly by the 16-bit RTP
+/// sequence number, giving O(1) insert, lookup and release.
+///
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// System include files.
+//------------------------------------------------------------------------------
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <stddef.h>
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Project include files.
+//------------------------------------------------------------------------------
+
+/// @brief Wrap-aware RTP sequence number comparison (RFC 3550 serial arithmetic).
+/// @return true if a precedes b, taking the 65535->0 wrap into account.
+inline bool SeqLess(uint16_t a, uint16_t b)
+{
+    return static_cast<int16_t>(static_cast<uint16_t>(a - b)) < 0;
+}
+
+/// @brief Signed distance from a to b in sequence space, in [-32768, 32767].
+inline int SeqDiff(uint16_t a, uint16_t b)
+{
+    return static_cast<int16_t>(static_cast<uint16_t>(b - a));
+}
+
+//------------------------------------------------------------------------------
+//
+template<typename T, size_t Capacity = 65536> class JitterBuffer
+//
+/// @brief This class stores items keyed by RTP sequence number in a direct
+/// mapped array of Capacity slots (slot = seq & (Capacity - 1)). With the
+/// default capacity there is exactly one slot per sequence number; smaller
+/// capacities alias, and an insert into a slot that still holds an older
+/// sequence number evicts it. The class is not thread safe.
+///
+//------------------------------------------------------------------------------
+{
+    static_assert(Capacity > 0 && Capacity <= 65536 && (Capacity & (Capacity - 1)) == 0,
+                  "JitterBuffer capacity must be a power of two no larger than 65536");
+
+public:
+    JitterBuffer()
+        :
+        m_slots(),
+        m_size(0)
+    {}
+
+    ~JitterBuffer()
+    {
+        Clear();
+    }
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    JitterBuffer( const JitterBuffer& ) = delete;
+    JitterBuffer( JitterBuffer&& ) = delete;
+    JitterBuffer& operator=( JitterBuffer&& ) = delete;
+    JitterBuffer& operator=( const JitterBuffer& ) = delete;
+
+    /// @brief Constructs an item in the slot for seq.
+    /// @param seq the RTP sequence number of the item.
+    /// @param args the arguments forwarded to the T constructor.
+    /// @return false if an item with this sequence number is already held.
+    template<typename... Args> bool Emplace(uint16_t seq, Args&&... args)
+    {
+        Slot& slot = m_slots[seq & MASK];
+        if (slot.occupied)
+        {
+            if (slot.seq == seq)
+            {
+                return false;
+            }
+            if (!SeqLess(slot.seq, seq))
+            {
+                // The slot holds a newer packet; the new one is stale.
+                return false;
+            }
+            Destroy(slot);
+        }
+        new (&slot.storage) T(std::forward<Args>(args)...);
+        slot.seq = seq;
+        slot.occupied = true;
+        ++m_size;
+        return true;
+    }
+
+    /// @brief Looks up the item for seq.
+    /// @return pointer to the item, or nullptr if it is not held.
+    T* Find(uint16_t seq)
+    {
+        Slot& slot = m_slots[seq & MASK];
+        return (slot.occupied && slot.seq == seq) ? Item(slot) : nullptr;
+    }
+
+    /// @brief Tests if an item for seq is held.
+    bool Contains(uint16_t seq) const
+    {
+        const Slot& slot = m_slots[seq & MASK];
+        return slot.occupied && slot.seq == seq;
+    }
+
+    /// @brief Destroys the item for seq if it is held.
+    /// @return true if an item was released.
+    bool Release(uint16_t seq)
+    {
+        Slot& slot = m_slots[seq & MASK];
+        if (!slot.occupied || slot.seq != seq)
+        {
+            return false;
+        }
+        Destroy(slot);
+        return true;
+    }
+
+    /// @brief Releases every item that precedes seq in sequence space.
+    /// This walks the whole buffer and is meant for resynchronisation, not
+    /// the per-packet path.
+    /// @param seq the first sequence number to keep.
+    /// @param onRelease called with each item before it is destroyed.
+    /// @return number of items released.
+    template<typename Fn> size_t ReleaseBefore(uint16_t seq, Fn onRelease)
+    {
+        size_t released = 0;
+        for (size_t i = 0; m_size && i < Capacity; ++i)
+        {
+            Slot& slot = m_slots[i];
+            if (slot.occupied && SeqLess(slot.seq, seq))
+            {
+                onRelease(*Item(slot));
+                Destroy(slot);
+                ++released;
+            }
+        }
+        return released;
+    }
+
+    /// @brief Obtains the number of items held.
+    size_t Size() const
+    {
+        return m_size;
+    }
+
+    /// @brief Tests if the buffer is empty.
+    bool Empty() const
+    {
+        return m_size == 0;
+    }
+
+    /// @brief Releases every item held.
+    void Clear()
+    {
+        for (size_t i = 0; m_size && i < Capacity; ++i)
+        {
+            if (m_slots[i].occupied)
+            {
+                Destroy(m_slots[i]);
+            }
+        }
+    }
+
+    static constexpr size_t CAPACITY = Capacity;
+
+protected:
+    static constexpr size_t MASK = Capacity - 1;
+
+    struct Slot
+    {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        uint16_t seq;
+        bool     occupied;
+    };
+
+    static T* Item(Slot& slot)
+    {
+        return reinterpret_cast<T*>(&slot.storage);
+    }
+
+    void Destroy(Slot& slot)
+    {
+        Item(slot)->~T();
+        slot.occupied = false;
+        --m_size;
+    }
+
+    Slot   m_slots[Capacity];
+    size_t m_size;
+};
+
+//------------------------------------------------------------------------------
+// End of file
+//------------------------------------------------------------------------------
+#endif // JITTERBUFFER_H_
@@ -0,0 +1,271 @@
+#ifndef LEGQUALITY_H_
+#define LEGQUALITY_H_
+//------------------------------------------------------------------------------
+//
+// Project: Hack2018
+// Module: LegQuality
+// File: LegQuality.h
+//
+//------------------------------------------------------------------------------
+/// @file
+/// @brief This file contains the LegQuality class.
+/// The class follows the RTP sequence numbers and timestamps of one leg to
+/// measure its loss, loss bursts, reordering, duplication and jitter.
+///
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// System include files.
+//------------------------------------------------------------------------------
+#include <cmath>
+#include <string>
+#include <stdint.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+// Project include files.
+//------------------------------------------------------------------------------
+#include "JitterBuffer.h"
+#include "Metrics.h"
+
+//------------------------------------------------------------------------------
+//
+class LegQuality
+//
+/// @brief This class keeps a sliding window of the last HISTORY sequence
+/// numbers of one leg, noting which have arrived. A sequence number is only
+/// declared lost when it slides out of the window unseen, so reordering
+/// within the window is not mistaken for loss. Consecutive lost sequence
+/// numbers form a loss run. A packet behind the highest sequence number seen
+/// is reordered, by that distance, or a duplicate if it was already seen.
+///
+/// Interarrival jitter is the RFC 3550 (section 6.4.1) estimate: the mean
+/// deviation of the difference in transit time between successive packets,
+/// smoothed with gain 1/16.
+///
+/// A jump of MAX_DROPOUT or more ahead, or more than HISTORY behind, is a
+/// source restart once the packet after it follows on (RFC 3550 appendix
+/// A.1); until then such packets are ignored. The class is not thread safe:
+/// it is updated by the thread receiving the leg, and read through its
+/// metrics by any thread.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    static const unsigned int HISTORY = 1024;
+    static const int MAX_DROPOUT = 3000;
+
+    /// @brief Constructor.
+    /// @param clockRate the RTP timestamp clock rate in Hz.
+    explicit LegQuality(uint32_t clockRate)
+        :
+        m_ticksPerNs(clockRate / 1e9),
+        m_clockRate(clockRate),
+        m_started(false),
+        m_highest(0),
+        m_span(0),
+        m_badSeq(-1),
+        m_seen(),
+        m_run(0),
+        m_lastArrivalNs(0),
+        m_lastTimestamp(0),
+        m_jitterTicks(0),
+        m_lost(),
+        m_lossRuns(),
+        m_duplicates(),
+        m_reordered(),
+        m_restarts(),
+        m_maxLossRun(),
+        m_maxReorderDepth(),
+        m_jitter()
+    {}
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    LegQuality( const LegQuality& ) = delete;
+    LegQuality( LegQuality&& ) = delete;
+    LegQuality& operator=( LegQuality&& ) = delete;
+    LegQuality& operator=( const LegQuality& ) = delete;
+
+    /// @brief Accounts for a packet received on the leg.
+    /// @param arrivalNs its arrival time on a monotonic clock.
+    void Update(uint16_t seq, uint32_t rtpTimestamp, uint64_t arrivalNs)
+    {
+        if (!m_started)
+        {
+            Restart(seq);
+        }
+
+        int distance = SeqDiff(m_highest, seq);
+        if (distance >= MAX_DROPOUT || distance < -static_cast<int>(HISTORY))
+        {
+            if (seq != m_badSeq)
+            {
+                m_badSeq = static_cast<uint16_t>(seq + 1);
+                return;
+            }
+            ++m_restarts;
+            Restart(seq);
+            distance = SeqDiff(m_highest, seq);
+        }
+        m_badSeq = -1;
+
+        if (distance > 0)
+        {
+            Advance(seq);
+            Mark(seq);
+        }
+        else if (-distance < static_cast<int>(m_span) && Seen(seq))
+        {
+            ++m_duplicates;
+            return;
+        }
+        else
+        {
+            ++m_reordered;
+            if (-distance > m_maxReorderDepth.Value())
+            {
+                m_maxReorderDepth.Set(-distance);
+            }
+            // Older than the window: already counted lost, nothing to mark
+            if (-distance < static_cast<int>(m_span))
+            {
+                Mark(seq);
+            }
+        }
+        UpdateJitter(rtpTimestamp, arrivalNs);
+    }
+
+    /// @brief Exports the leg's quality under the given labels.
+    void RegisterMetrics(MetricsRegistry& metrics, const std::string& labels) const
+    {
+        metrics.Add("leg_lost_total", "Sequence numbers never received on the leg", labels, m_lost);
+        metrics.Add("leg_loss_runs_total", "Runs of consecutive lost sequence numbers", labels, m_lossRuns);
+        metrics.Add("leg_loss_run_max", "Longest run of consecutive lost sequence numbers", labels, m_maxLossRun);
+        metrics.Add("leg_duplicate_total", "Packets received more than once on the leg", labels, m_duplicates);
+        metrics.Add("leg_reordered_total", "Packets received behind a later sequence number", labels, m_reordered);
+        metrics.Add("leg_reorder_depth_max", "Furthest a packet arrived behind the highest sequence number",
+                    labels, m_maxReorderDepth);
+        metrics.Add("leg_jitter_seconds", "RFC 3550 interarrival jitter", labels, m_jitter);
+        metrics.Add("leg_restart_total", "Sequence number restarts", labels, m_restarts);
+    }
+
+protected:
+    static const unsigned int WORDS = HISTORY / 64;
+
+    bool Seen(uint16_t seq) const
+    {
+        unsigned int bit = seq % HISTORY;
+        return (m_seen[bit / 64] >> (bit % 64)) & 1;
+    }
+
+    void Mark(uint16_t seq)
+    {
+        unsigned int bit = seq % HISTORY;
+        m_seen[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+
+    void Clear(uint16_t seq)
+    {
+        unsigned int bit = seq % HISTORY;
+        m_seen[bit / 64] &= ~(uint64_t(1) << (bit % 64));
+    }
+
+    /// @brief Slides the window up to seq, settling the fate of each
+    /// sequence number that falls out of it.
+    void Advance(uint16_t seq)
+    {
+        for (uint16_t next = static_cast<uint16_t>(m_highest + 1); ; ++next)
+        {
+            // The bit for next last held next - HISTORY
+            if (m_span == HISTORY)
+            {
+                if (!Seen(next))
+                {
+                    ++m_lost;
+                    ++m_run;
+                }
+                else
+                {
+                    EndRun();
+                }
+            }
+            else
+            {
+                ++m_span;
+            }
+            Clear(next);
+            if (next == seq)
+            {
+                break;
+            }
+        }
+        m_highest = seq;
+    }
+
+    void EndRun()
+    {
+        if (m_run == 0)
+        {
+            return;
+        }
+        ++m_lossRuns;
+        if (m_run > m_maxLossRun.Value())
+        {
+            m_maxLossRun.Set(m_run);
+        }
+        m_run = 0;
+    }
+
+    void UpdateJitter(uint32_t rtpTimestamp, uint64_t arrivalNs)
+    {
+        if (m_lastArrivalNs != 0)
+        {
+            double arrivalTicks = static_cast<double>(static_cast<int64_t>(arrivalNs - m_lastArrivalNs)) * m_ticksPerNs;
+            double d = arrivalTicks - static_cast<int32_t>(rtpTimestamp - m_lastTimestamp);
+            m_jitterTicks += (std::fabs(d) - m_jitterTicks) / 16;
+            m_jitter.Set(m_jitterTicks / m_clockRate);
+        }
+        m_lastArrivalNs = arrivalNs;
+        m_lastTimestamp = rtpTimestamp;
+    }
+
+    void Restart(uint16_t seq)
+    {
+        memset(m_seen, 0, sizeof(m_seen));
+        m_started = true;
+        m_highest = static_cast<uint16_t>(seq - 1);
+        m_span = 0;
+        m_run = 0;
+        m_lastArrivalNs = 0;
+    }
+
+    const double m_ticksPerNs;
+    const uint32_t m_clockRate;
+    bool m_started;
+    uint16_t m_highest;
+    unsigned int m_span;        // sequence numbers tracked, up to HISTORY
+    int m_badSeq;               // expected after a suspected restart, or -1
+    uint64_t m_seen[WORDS];
+    unsigned int m_run;         // unseen sequence numbers leaving the window
+    uint64_t m_lastArrivalNs;
+    uint32_t m_lastTimestamp;
+    double m_jitterTicks;
+
+    Counter m_lost;
+    Counter m_lossRuns;
+    Counter m_duplicates;
+    Counter m_reordered;
+    Counter m_restarts;
+    Gauge m_maxLossRun;
+    Gauge m_maxReorderDepth;
+    Gauge m_jitter;
+};
+
+//------------------------------------------------------------------------------
+// End of file
+//------------------------------------------------------------------------------
+#endif // LEGQUALITY_H_
@@ -0,0 +1,416 @@
+#ifndef LOCKFREEQUEUE_H_
+#define LOCKFREEQUEUE_H_
+//------------------------------------------------------------------------------
+//
+// Project: Hack2018
+// Module: LockFreeQueue
+// File: LockFreeQueue.h
+//
+//------------------------------------------------------------------------------
+/// @file
+/// @brief This file contains the LockFreeQueue class template.
+/// The queue is a bounded multi-producer/multi-consumer FIFO with the
+/// interface of ThreadSafeQueue, built on a lock-free ring.
+///
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// System include files.
+//------------------------------------------------------------------------------
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <stddef.h>
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Project include files.
+//------------------------------------------------------------------------------
+#include "CacheLine.h"
+
+//------------------------------------------------------------------------------
+//
+template<typename T> class LockFreeQueue : public CacheAligned
+//
+/// @brief This class is a drop-in for a bounded ThreadSafeQueue<T> where
+/// several threads push and pop at once. It is Dmitry Vyukov's bounded MPMC
+/// queue: each cell carries a sequence number saying whether it is ready to
+/// be written or read on the current lap, and producers and consumers each
+/// claim a cell with one compare-and-swap on their own position counter. No
+/// operation takes a lock unless a consumer has to sleep.
+///
+/// A consumer waiting on an empty queue parks on a condition variable. A
+/// producer only touches the mutex when the waiter count says someone is
+/// parked, so the uncontended paths stay lock-free.
+///
+/// Differences from ThreadSafeQueue: the capacity is rounded up to a power
+/// of two and must not be zero; Size() is a snapshot; PopIf() can only
+/// take items from the head, so it rotates items that do not match to the
+/// tail (see PopIf()); and there is no Count().
+///
+//------------------------------------------------------------------------------
+{
+public:
+    /// @brief Constructor.
+    /// @param maxEntries the number of items the queue holds before a push
+    /// discards the oldest, rounded up to a power of two.
+    explicit LockFreeQueue(const uint32_t maxEntries)
+        :
+        m_capacity(RoundUp(maxEntries)),
+        m_mask(m_capacity - 1),
+        m_cells(new Cell[m_capacity]),
+        m_enqueuePos(0),
+        m_dequeuePos(0),
+        m_waiters(0),
+        m_mutex(),
+        m_conditionVariable()
+    {
+        for (size_t i = 0; i < m_capacity; ++i)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /// @brief virtual destructor
+    virtual ~LockFreeQueue()
+    {}
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    LockFreeQueue( const LockFreeQueue& ) = delete;
+    LockFreeQueue( LockFreeQueue&& ) = delete;
+    LockFreeQueue& operator=( LockFreeQueue&& ) = delete;
+    LockFreeQueue& operator=( const LockFreeQueue& ) = delete;
+
+    /// @brief Appends all items from a source queue onto this one
+    ///
+    /// @param srcQueue The queue from which to move all items across
+    /// @return number of items moved
+    size_t AppendAllItems(LockFreeQueue<T>& srcQueue)
+    {
+        size_t numberOfMovedItems = 0;
+        T item;
+        while (srcQueue.TryPop(item))
+        {
+            Push(std::move(item));
+            ++numberOfMovedItems;
+        }
+        return numberOfMovedItems;
+    }
+
+    /// @brief Pushes an item into the queue, discarding the oldest if full.
+    /// This method retains a valid user copy of the pushed item.
+    /// @param item the new item to be pushed onto the queue.
+    void Push( const T& item )
+    {
+        while (!TryPush(item))
+        {
+            Discard();
+        }
+        WakeOne();
+    }
+
+    /// @brief Pushes an item into the queue, discarding the oldest if full.
+    /// This method invalidates user copy of the pushed item.
+    /// @param item the new item to be pushed onto the queue.
+    void Push( T&& item )
+    {
+        while (!TryPush(std::move(item)))
+        {
+            Discard();
+        }
+        WakeOne();
+    }
+
+    /// @brief Waits indefinetelly on an empty queue, popping the next
+    /// item off the queue as it becomes available.
+    /// @return item popped off the queue.
+    T WaitAndPop()
+    {
+        T item;
+        if (TryPop(item))
+        {
+            return item;
+        }
+        std::unique_lock<std::mutex> theMutex(m_mutex);
+        m_waiters.fetch_add(1);
+        m_conditionVariable.wait(theMutex, [this, &item]{ return TryPop(item); });
+        m_waiters.fetch_sub(1);
+        return item;
+    }
+
+    /// @brief Waits until either an item is available or a timeout, popping the next
+    /// item off the queue as it becomes available.
+    /// @param item the item popped off the queue.
+    /// @param duration the timeout.
+    /// @return true if successful, false if timedout.
+    template<class Rep, class Period>
+    bool WaitAndPop(T& item, const std::chrono::duration<Rep, Period>& duration)
+    {
+        std::chrono::duration<Rep, Period> nonConstDuration = duration;
+        return WaitAndPop(item, nonConstDuration);
+    }
+
+    /// @brief Waits until either an item is available or a timeout, popping the next
+    /// item off the queue as it becomes available.
+    /// @param item the item popped off the queue.
+    /// @param duration the timeout on entry, remaining time on exit.
+    /// @return true if successful, false if timedout.
+    template<class Rep, class Period>
+    bool WaitAndPop(T& item, std::chrono::duration<Rep, Period>& duration)
+    {
+        return TryPop(item) || WaitFor(duration, [this, &item]{ return TryPop(item); });
+    }
+
+    /// @brief Waits until either an item is available or a timeout
+    /// @param duration the timeout.
+    /// @return true if successful, false if timedout.
+    template<class Rep, class Period>
+    bool Wait(const std::chrono::duration<Rep, Period>& duration)
+    {
+        std::chrono::duration<Rep, Period> nonConstDuration = duration;
+        return Wait(nonConstDuration);
+    }
+
+    /// @brief Waits until either an item is available or a timeout.
+    /// @param duration the timeout on entry, remaining time on exit.
+    /// @return true if successful, false if timedout.
+    template<class Rep, class Period>
+    bool Wait(std::chrono::duration<Rep, Period>& duration)
+    {
+        return !Empty() || WaitFor(duration, [this]{ return !Empty(); });
+    }
+
+    /// @brief Tries to pop the next item off the queue if available.
+    /// @param item the returned item.
+    /// @return true if successful, false if queue is empty.
+    bool TryPop( T& item )
+    {
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell& cell = m_cells[pos & m_mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t lap = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (lap == 0)
+            {
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    item = std::move(cell.data);
+                    // Ready for the producer one lap on
+                    cell.sequence.store(pos + m_capacity, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (lap < 0)
+            {
+                // Not yet written on this lap: empty
+                return false;
+            }
+            else
+            {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// @brief Tries to pop a matching item off the queue if available.
+    /// Lock-free consumers can only take the head, so this takes up to Size()
+    /// items in turn and pushes those that do not match back at the tail.
+    /// Items that do not match therefore change places with ones pushed
+    /// meanwhile; use it only where that order does not matter.
+    /// @param item the returned item.
+    /// @param condition the condition used to find the item.
+    /// @return true if successful, false if a matching item isn't found
+    template<typename _Predicate> bool PopIf(T& item, _Predicate condition)
+    {
+        for (size_t remaining = Size(); remaining > 0 && TryPop(item); --remaining)
+        {
+            if (condition(item))
+            {
+                return true;
+            }
+            Push(std::move(item));
+        }
+        return false;
+    }
+
+    /// @brief Tries to pop a matching item off the queue if available.
+    /// @param item the returned item.
+    /// @param duration the timeout on entry, remaining time on exit.
+    /// @param condition the condition used to find the item.
+    /// @return true if successful, false if a matching item isn't found
+    template<class Rep, class Period, typename _Predicate>
+    bool WaitAndPopIf(T& item, std::chrono::duration<Rep, Period>& duration, _Predicate condition)
+    {
+        return PopIf(item, condition)
+            || WaitFor(duration, [this, &item, &condition] { return PopIfNoWake(item, condition); });
+    }
+
+    /// @brief Tests if the queue is empty.
+    /// @return true if the queue is empty.
+    bool Empty() const
+    {
+        return Size() == 0;
+    }
+
+    /// @brief Obtains the size (number of items) of the queue, as it was at
+    /// some moment during the call.
+    /// @return number of items in the queue.
+    size_t Size() const
+    {
+        size_t dequeuePos = m_dequeuePos.load(std::memory_order_acquire);
+        size_t enqueuePos = m_enqueuePos.load(std::memory_order_acquire);
+        return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+    }
+
+    /// @brief Clears the queue setting its size to 0.
+    void Clear()
+    {
+        T item;
+        while (TryPop(item))
+        {}
+    }
+
+protected:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T                   data;
+    };
+
+    static size_t RoundUp(size_t n)
+    {
+        if (n == 0)
+        {
+            throw std::invalid_argument("LockFreeQueue: zero capacity");
+        }
+        size_t p = 1;
+        while (p < n)
+        {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    /// @brief Writes an item into the next free cell.
+    /// @return false if the queue is full.
+    template<typename U> bool TryPush(U&& item)
+    {
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell& cell = m_cells[pos & m_mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t lap = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (lap == 0)
+            {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.data = std::forward<U>(item);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (lap < 0)
+            {
+                // Not yet read on the previous lap: full
+                return false;
+            }
+            else
+            {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// @brief PopIf() for a consumer that holds m_mutex, as in a wait. The
+    /// items that do not match go back without waking anyone: they were in
+    /// the queue already, and WakeOne() would lock m_mutex again.
+    template<typename _Predicate> bool PopIfNoWake(T& item, _Predicate& condition)
+    {
+        for (size_t remaining = Size(); remaining > 0 && TryPop(item); --remaining)
+        {
+            if (condition(item))
+            {
+                return true;
+            }
+            while (!TryPush(std::move(item)))
+            {
+                Discard();
+            }
+        }
+        return false;
+    }
+
+    /// @brief Drops the oldest item to make room, as a bounded
+    /// ThreadSafeQueue does.
+    void Discard()
+    {
+        T discarded;
+        TryPop(discarded);
+    }
+
+    /// @brief Wakes any parked consumers; with PopIf() waiters about, the
+    /// one woken by notify_one() might not want the item.
+    void WakeOne()
+    {
+        // Pairs with the waiter count increment: either the consumer sees
+        // the item when it checks, or this sees the consumer
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> theMutex(m_mutex);
+            m_conditionVariable.notify_all();
+        }
+    }
+
+    /// @brief Parks until either the specified condition is met, or a timeout.
+    /// @param duration the timeout on entry, remaining time on exit.
+    /// @param conditionCheck   Function that checks if the condition is met
+    /// @return true if successful, false if timedout.
+    template<class Rep, class Period, class ConditionCheckFn>
+    bool WaitFor(std::chrono::duration<Rep, Period>& duration, ConditionCheckFn conditionCheck)
+    {
+        typedef std::chrono::duration<Rep, Period> DurationType;
+        typedef std::chrono::steady_clock ClockType;
+        auto const timeout = ClockType::now() + std::chrono::duration_cast<ClockType::duration>(duration);
+        std::unique_lock<std::mutex> theMutex(m_mutex);
+        m_waiters.fetch_add(1);
+        bool timedOut = !m_conditionVariable.wait_until(theMutex, timeout, conditionCheck);
+        m_waiters.fetch_sub(1);
+        auto const endTime = ClockType::now();
+        if (timedOut)
+        {
+            duration = DurationType{0};
+            return false;
+        }
+        duration = std::chrono::duration_cast<DurationType>(timeout - endTime);
+        return true;
+    }
+
+    const size_t            m_capacity;
+    const size_t            m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+
+    // Producer and consumer positions on lines of their own
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_enqueuePos;
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_dequeuePos;
+
+    // Parking for consumers that find the queue empty
+    alignas(CACHE_LINE_SIZE) std::atomic<unsigned int> m_waiters;
+    std::mutex              m_mutex;
+    std::condition_variable m_conditionVariable;
+};
+
+//------------------------------------------------------------------------------
+// End of file
+//------------------------------------------------------------------------------
+#endif // LOCKFREEQUEUE_H_
@@ -0,0 +1,485 @@
+#ifndef LOG_H_
+#define LOG_H_
+//------------------------------------------------------------------------------
+//
+// Project: Hack2018
+// Module: Log
+// File: Log.h
+//
+//------------------------------------------------------------------------------
+/// @file
+/// @brief This file contains the Logger class and the LOG_* macros.
+/// Logging from the packet path copies a small binary record into a
+/// per-thread ring; a background thread formats and writes it.
+///
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// System include files.
+//------------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+//------------------------------------------------------------------------------
+// Project include files.
+//------------------------------------------------------------------------------
+#include "SpscRing.h"
+
+/// @brief Severity of a log record, lowest first.
+enum class LogLevel : uint8_t
+{
+    Debug,
+    Info,
+    Warning,
+    Error
+};
+
+/// @brief Records each thread can have waiting to be formatted.
+const size_t LOG_RING_RECORDS = 4096;
+
+/// @brief Arguments, and bytes of copied string arguments, per record.
+const unsigned int LOG_MAX_ARGS = 8;
+const unsigned int LOG_TEXT_BYTES = 64;
+
+/// @brief Records one call site may emit per second before it is muted.
+const uint32_t LOG_SITE_RATE = 100;
+
+//------------------------------------------------------------------------------
+//
+struct LogSite
+//
+/// @brief This struct is the rate limiter of one LOG_* call site. Each site
+/// may emit LOG_SITE_RATE records per one-second window; the rest are counted
+/// and the count is reported with the site's next record.
+///
+//------------------------------------------------------------------------------
+{
+    std::atomic<uint64_t> window{0};
+    std::atomic<uint32_t> count{0};
+    std::atomic<uint32_t> suppressed{0};
+
+    /// @brief Decides if a record may be emitted now.
+    /// @param suppressedOut set to the records muted since the last one emitted.
+    bool Admit(uint64_t timeNs, uint32_t& suppressedOut)
+    {
+        uint64_t now = timeNs / 1000000000;
+        if (window.load(std::memory_order_relaxed) != now)
+        {
+            // Racy by design: concurrent callers may both reset the window
+            window.store(now, std::memory_order_relaxed);
+            count.store(0, std::memory_order_relaxed);
+        }
+        if (count.fetch_add(1, std::memory_order_relaxed) >= LOG_SITE_RATE)
+        {
+            suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        suppressedOut = suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+};
+
+//------------------------------------------------------------------------------
+//
+struct LogRecord
+//
+/// @brief This struct is one log call, unformatted. The format string is not
+/// copied and must be a literal; numeric arguments are widened to 64 bits and
+/// string arguments are copied (truncated) into text.
+///
+//------------------------------------------------------------------------------
+{
+    union Arg
+    {
+        int64_t  i;
+        uint64_t u;
+        double   d;
+        uint32_t textOffset;
+    };
+
+    uint64_t    timeNs;
+    const char* format;
+    uint32_t    suppressed;
+    LogLevel    level;
+    uint8_t     argCount;
+    uint8_t     textUsed;
+    Arg         args[LOG_MAX_ARGS];
+    char        text[LOG_TEXT_BYTES];
+};
+
+//------------------------------------------------------------------------------
+//
+class Logger
+//
+/// @brief This class owns the per-thread rings and the thread that drains
+/// them. Writers never lock or make system calls: a record goes into the
+/// calling thread's SpscRing, or is counted as dropped if the ring is full.
+/// The background thread merges the rings in time order, formats each
+/// record with printf semantics and writes the batch to stdout.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    /// @brief Obtains the process logger, starting it on first use.
+    static Logger& Instance()
+    {
+        static Logger logger;
+        return logger;
+    }
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    Logger( const Logger& ) = delete;
+    Logger( Logger&& ) = delete;
+    Logger& operator=( Logger&& ) = delete;
+    Logger& operator=( const Logger& ) = delete;
+
+    ~Logger()
+    {
+        m_stop.store(true, std::memory_order_relaxed);
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    /// @brief Sets the lowest level that is recorded.
+    static void SetLevel(LogLevel level)
+    {
+        Threshold().store(static_cast<uint8_t>(level), std::memory_order_relaxed);
+    }
+
+    /// @brief Tests if records at level are recorded.
+    static bool Enabled(LogLevel level)
+    {
+        return static_cast<uint8_t>(level) >= Threshold().load(std::memory_order_relaxed);
+    }
+
+    /// @brief Records a log call from the current thread.
+    /// @param format a printf format string literal.
+    template<typename... Args> void Write(LogSite& site, LogLevel level, const char* format, Args... args)
+    {
+        static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "Too many log arguments");
+
+        LogRecord record;
+        record.timeNs = NowNs();
+        if (!site.Admit(record.timeNs, record.suppressed))
+        {
+            return;
+        }
+        record.format = format;
+        record.level = level;
+        record.argCount = 0;
+        record.textUsed = 0;
+        Pack(record, args...);
+
+        ThreadLog& log = Local();
+        if (!log.ring->Push(record))
+        {
+            log.dropped.store(log.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+
+protected:
+    /// @brief The ring of one writer thread, and the records it had to drop.
+    struct ThreadLog
+    {
+        ThreadLog()
+            :
+            ring(new SpscRing<LogRecord>(LOG_RING_RECORDS)),
+            dropped(0),
+            reported(0)
+        {}
+
+        std::unique_ptr<SpscRing<LogRecord>> ring;
+        std::atomic<uint64_t>                dropped;
+        uint64_t                             reported;
+    };
+
+    Logger()
+        :
+        m_mutex(),
+        m_logs(),
+        m_stop(false),
+        m_thread()
+    {
+        m_thread = std::thread(&Logger::Run, this);
+    }
+
+    static std::atomic<uint8_t>& Threshold()
+    {
+        static std::atomic<uint8_t> threshold{static_cast<uint8_t>(LogLevel::Info)};
+        return threshold;
+    }
+
+    static uint64_t NowNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    /// @brief Obtains the calling thread's ring, creating it on first use.
+    ThreadLog& Local()
+    {
+        static thread_local ThreadLog* local = nullptr;
+        if (local == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_logs.emplace_back(new ThreadLog);
+            local = m_logs.back().get();
+        }
+        return *local;
+    }
+
+    static void Pack(LogRecord&)
+    {
+    }
+
+    template<typename T, typename... Rest> static void Pack(LogRecord& record, T arg, Rest... rest)
+    {
+        PackOne(record, record.args[record.argCount++], arg);
+        Pack(record, rest...);
+    }
+
+    template<typename T>
+    static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+    PackOne(LogRecord&, LogRecord::Arg& out, T value)
+    {
+        out.i = value;
+    }
+
+    template<typename T>
+    static typename std::enable_if<(std::is_integral<T>::value && std::is_unsigned<T>::value)
+                                   || std::is_enum<T>::value>::type
+    PackOne(LogRecord&, LogRecord::Arg& out, T value)
+    {
+        out.u = static_cast<uint64_t>(value);
+    }
+
+    template<typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type
+    PackOne(LogRecord&, LogRecord::Arg& out, T value)
+    {
+        out.d = value;
+    }
+
+    static void PackOne(LogRecord& record, LogRecord::Arg& out, const char* value)
+    {
+        size_t room = LOG_TEXT_BYTES - record.textUsed;
+        if (room == 0)
+        {
+            // Out of space; point at the terminator of the last string
+            out.textOffset = LOG_TEXT_BYTES - 1;
+            return;
+        }
+        if (value == nullptr)
+        {
+            value = "(null)";
+        }
+        out.textOffset = record.textUsed;
+        size_t len = strnlen(value, room - 1);
+        memcpy(record.text + record.textUsed, value, len);
+        record.text[record.textUsed + len] = '\0';
+        record.textUsed = static_cast<uint8_t>(record.textUsed + len + 1);
+    }
+
+    static void PackOne(LogRecord& record, LogRecord::Arg& out, char* value)
+    {
+        PackOne(record, out, static_cast<const char*>(value));
+    }
+
+    static void PackOne(LogRecord& record, LogRecord::Arg& out, const std::string& value)
+    {
+        PackOne(record, out, value.c_str());
+    }
+
+    static void PackOne(LogRecord&, LogRecord::Arg& out, const void* value)
+    {
+        out.u = reinterpret_cast<uintptr_t>(value);
+    }
+
+    void Run()
+    {
+        std::vector<LogRecord> batch;
+        std::string out;
+        bool stopping = false;
+        while (!stopping)
+        {
+            // Take one last pass after the stop request
+            stopping = m_stop.load(std::memory_order_relaxed);
+            batch.clear();
+            out.clear();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for (auto& log : m_logs)
+                {
+                    LogRecord record;
+                    while (log->ring->Pop(record))
+                    {
+                        batch.push_back(record);
+                    }
+                    uint64_t dropped = log->dropped.load(std::memory_order_relaxed);
+                    if (dropped != log->reported)
+                    {
+                        out += "Log ring full, " + std::to_string(dropped - log->reported) + " records dropped\n";
+                        log->reported = dropped;
+                    }
+                }
+            }
+
+            if (batch.empty() && out.empty())
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            std::stable_sort(batch.begin(), batch.end(),
+                             [](const LogRecord& a, const LogRecord& b) { return a.timeNs < b.timeNs; });
+            for (const LogRecord& record : batch)
+            {
+                Format(record, out);
+            }
+            fwrite(out.data(), 1, out.size(), stdout);
+            fflush(stdout);
+        }
+    }
+
+    /// @brief Appends "hh:mm:ss.uuuuuu L message" and a newline to out.
+    static void Format(const LogRecord& record, std::string& out)
+    {
+        static const char LEVELS[] = {'D', 'I', 'W', 'E'};
+        char buf[256];
+        time_t secs = static_cast<time_t>(record.timeNs / 1000000000);
+        struct tm tm;
+        localtime_r(&secs, &tm);
+        snprintf(buf, sizeof(buf), "%02d:%02d:%02d.%06u %c ", tm.tm_hour, tm.tm_min, tm.tm_sec,
+                 static_cast<unsigned int>(record.timeNs % 1000000000 / 1000),
+                 LEVELS[static_cast<unsigned int>(record.level) & 3]);
+        out += buf;
+
+        unsigned int argIndex = 0;
+        for (const char* p = record.format; *p; ++p)
+        {
+            if (*p != '%')
+            {
+                out += *p;
+                continue;
+            }
+            if (p[1] == '%')
+            {
+                out += '%';
+                ++p;
+                continue;
+            }
+
+            // Rebuild the conversion with a length modifier that matches
+            // how the argument was stored
+            std::string spec(1, '%');
+            for (++p; *p && strchr("-+ #0123456789.", *p); ++p)
+            {
+                spec += *p;
+            }
+            while (*p && strchr("hlLqjzt", *p))
+            {
+                ++p;
+            }
+            if (*p == '\0')
+            {
+                break;
+            }
+            if (argIndex == record.argCount)
+            {
+                out += "<?>";
+                continue;
+            }
+
+            const LogRecord::Arg& arg = record.args[argIndex++];
+            switch (*p)
+            {
+            case 'd':
+            case 'i':
+                snprintf(buf, sizeof(buf), (spec + "ll" + *p).c_str(), static_cast<long long>(arg.i));
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                snprintf(buf, sizeof(buf), (spec + "ll" + *p).c_str(), static_cast<unsigned long long>(arg.u));
+                break;
+            case 'c':
+                snprintf(buf, sizeof(buf), (spec + *p).c_str(), static_cast<int>(arg.i));
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+                snprintf(buf, sizeof(buf), (spec + *p).c_str(), arg.d);
+                break;
+            case 's':
+                snprintf(buf, sizeof(buf), (spec + *p).c_str(), record.text + arg.textOffset);
+                break;
+            case 'p':
+                snprintf(buf, sizeof(buf), (spec + *p).c_str(), reinterpret_cast<void*>(arg.u));
+                break;
+            default:
+                snprintf(buf, sizeof(buf), "<%%%c?>", *p);
+                break;
+            }
+            out += buf;
+        }
+
+        // Messages conventionally end in a newline; normalise to exactly one
+        while (!out.empty() && out.back() == '\n')
+        {
+            out.pop_back();
+        }
+        if (record.suppressed)
+        {
+            out += " (" + std::to_string(record.suppressed) + " similar suppressed)";
+        }
+        out += '\n';
+    }
+
+    std::mutex                              m_mutex;
+    std::vector<std::unique_ptr<ThreadLog>> m_logs;
+    std::atomic<bool>                       m_stop;
+    std::thread                             m_thread;
+};
+
+/// @brief Records a printf-style message at a level, if enabled. The format
+/// must be a string literal. Each call site is rate limited on its own.
+#define LOG_AT(level, ...)                                                   \
+    do                                                                       \
+    {                                                                        \
+        if (Logger::Enabled(level))                                          \
+        {                                                                    \
+            static LogSite logSite;                                          \
+            Logger::Instance().Write(logSite, level, __VA_ARGS__);           \
+        }                                                                    \
+    } while (0)
+
+#define LOG_DEBUG(...)   LOG_AT(LogLevel::Debug, __VA_ARGS__)
+#define LOG_INFO(...)    LOG_AT(LogLevel::Info, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_AT(LogLevel::Warning, __VA_ARGS__)
+#define LOG_ERROR(...)   LOG_AT(LogLevel::Error, __VA_ARGS__)
+
+//------------------------------------------------------------------------------
+// End of file
+//------------------------------------------------------------------------------
+#endif // LOG_H_
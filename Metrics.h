@@ -0,0 +1,445 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+//------------------------------------------------------------------------------
+//
+// Project: Hack2018
+// Module: Metrics
+// File: Metrics.h
+//
+//------------------------------------------------------------------------------
+/// @file
+/// @brief This file contains the Counter, Gauge, MetricsRegistry and
+/// MetricsExporter classes. Counters, gauges and latency histograms are
+/// updated on the packet path without locks or system calls; a background
+/// thread publishes them in the Prometheus text format.
+///
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// System include files.
+//------------------------------------------------------------------------------
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+//------------------------------------------------------------------------------
+// Project include files.
+//------------------------------------------------------------------------------
+#include "CacheLine.h"
+#include "Histogram.h"
+
+/// @brief Quantiles exported for each histogram; 1 is the exact maximum.
+const double SUMMARY_QUANTILES[] = {0.5, 0.9, 0.99, 0.999, 1};
+
+//------------------------------------------------------------------------------
+//
+class alignas(CACHE_LINE_SIZE) Counter
+//
+/// @brief This class is a monotonic 64-bit count with a single writer. The
+/// owning thread updates it with a plain load and store (no locked
+/// read-modify-write), and any thread may read it. Each counter has a cache
+/// line to itself, so bumping it never invalidates a line another thread is
+/// using.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    Counter()
+        :
+        m_value(0)
+    {}
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    Counter( const Counter& ) = delete;
+    Counter( Counter&& ) = delete;
+    Counter& operator=( Counter&& ) = delete;
+    Counter& operator=( const Counter& ) = delete;
+
+    /// @brief Adds to the count. Owning thread only.
+    Counter& operator+=(uint64_t n)
+    {
+        m_value.store(m_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        return *this;
+    }
+
+    /// @brief Adds one to the count. Owning thread only.
+    Counter& operator++()
+    {
+        return *this += 1;
+    }
+
+    /// @brief Reads the count. Any thread.
+    uint64_t Value() const
+    {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+protected:
+    std::atomic<uint64_t> m_value;
+};
+
+//------------------------------------------------------------------------------
+//
+class alignas(CACHE_LINE_SIZE) Gauge
+//
+/// @brief This class is a value that can go up and down, with a single
+/// writer, kept on a cache line of its own like Counter.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    Gauge()
+        :
+        m_value(0)
+    {}
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    Gauge( const Gauge& ) = delete;
+    Gauge( Gauge&& ) = delete;
+    Gauge& operator=( Gauge&& ) = delete;
+    Gauge& operator=( const Gauge& ) = delete;
+
+    /// @brief Sets the value. Owning thread only.
+    void Set(double value)
+    {
+        m_value.store(value, std::memory_order_relaxed);
+    }
+
+    /// @brief Reads the value. Any thread.
+    double Value() const
+    {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+protected:
+    std::atomic<double> m_value;
+};
+
+//------------------------------------------------------------------------------
+//
+class MetricsRegistry
+//
+/// @brief This class names counters, gauges and histograms for export. Each metric
+/// family has a name and help text, and one sample per label set, e.g.
+/// rx_packets_total{leg="1"}. Histograms are exported as summaries in
+/// seconds, with the quantiles in SUMMARY_QUANTILES. Everything is registered
+/// before the exporter starts and must outlive it.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    MetricsRegistry()
+        :
+        m_families()
+    {}
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    MetricsRegistry( const MetricsRegistry& ) = delete;
+    MetricsRegistry( MetricsRegistry&& ) = delete;
+    MetricsRegistry& operator=( MetricsRegistry&& ) = delete;
+    MetricsRegistry& operator=( const MetricsRegistry& ) = delete;
+
+    /// @brief Registers a counter.
+    /// @param name the metric name, conventionally ending in _total.
+    /// @param help the one-line description exported with the family.
+    /// @param labels the label set without braces, e.g. session="1",leg="2".
+    /// @param counter the counter to sample.
+    void Add(const std::string& name, const std::string& help, const std::string& labels, const Counter& counter)
+    {
+        Find(name, help, "counter").samples.push_back(Sample{labels, &counter, nullptr, nullptr});
+    }
+
+    /// @brief Registers a gauge.
+    void Add(const std::string& name, const std::string& help, const std::string& labels, const Gauge& gauge)
+    {
+        Find(name, help, "gauge").samples.push_back(Sample{labels, nullptr, &gauge, nullptr});
+    }
+
+    /// @brief Registers a latency histogram.
+    /// @param name the metric name, conventionally ending in _seconds.
+    void Add(const std::string& name, const std::string& help, const std::string& labels,
+             const LatencyHistogram& histogram)
+    {
+        Find(name, help, "summary").samples.push_back(Sample{labels, nullptr, nullptr, &histogram});
+    }
+
+    /// @brief Samples every counter and histogram into the Prometheus text
+    /// format.
+    std::string Format() const
+    {
+        std::string text;
+        for (const Family& family : m_families)
+        {
+            text += "# HELP " + family.name + " " + family.help + "\n";
+            text += "# TYPE " + family.name + " " + family.type + "\n";
+            for (const Sample& sample : family.samples)
+            {
+                if (sample.counter)
+                {
+                    text += family.name + Braces(sample.labels) + " " + std::to_string(sample.counter->Value()) + "\n";
+                    continue;
+                }
+                if (sample.gauge)
+                {
+                    char value[32];
+                    snprintf(value, sizeof(value), "%.9g", sample.gauge->Value());
+                    text += family.name + Braces(sample.labels) + " " + value + "\n";
+                    continue;
+                }
+
+                const size_t quantileCount = sizeof(SUMMARY_QUANTILES) / sizeof(SUMMARY_QUANTILES[0]);
+                uint64_t valuesNs[quantileCount];
+                sample.histogram->Percentiles(SUMMARY_QUANTILES, quantileCount, valuesNs);
+                std::string prefix = sample.labels.empty() ? "" : sample.labels + ",";
+                for (size_t q = 0; q < quantileCount; ++q)
+                {
+                    char quantile[16];
+                    snprintf(quantile, sizeof(quantile), "%g", SUMMARY_QUANTILES[q]);
+                    text += family.name + "{" + prefix + "quantile=\"" + quantile + "\"} "
+                          + Seconds(valuesNs[q]) + "\n";
+                }
+                text += family.name + "_sum" + Braces(sample.labels) + " " + Seconds(sample.histogram->SumNs()) + "\n";
+                text += family.name + "_count" + Braces(sample.labels) + " "
+                      + std::to_string(sample.histogram->Count()) + "\n";
+            }
+        }
+        return text;
+    }
+
+protected:
+    struct Sample
+    {
+        std::string             labels;
+        const Counter*          counter;
+        const Gauge*            gauge;
+        const LatencyHistogram* histogram;
+    };
+
+    struct Family
+    {
+        std::string         name;
+        std::string         help;
+        std::string         type;
+        std::vector<Sample> samples;
+    };
+
+    /// @brief Finds a family, creating it on first use.
+    Family& Find(const std::string& name, const std::string& help, const char* type)
+    {
+        for (Family& family : m_families)
+        {
+            if (family.name == name)
+            {
+                return family;
+            }
+        }
+        m_families.push_back(Family{name, help, type, {}});
+        return m_families.back();
+    }
+
+    static std::string Braces(const std::string& labels)
+    {
+        return labels.empty() ? labels : "{" + labels + "}";
+    }
+
+    static std::string Seconds(uint64_t ns)
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "%.9f", ns / 1e9);
+        return text;
+    }
+
+    std::vector<Family> m_families;
+};
+
+//------------------------------------------------------------------------------
+//
+class MetricsExporter
+//
+/// @brief This class runs a thread that publishes a registry's counters. Every
+/// period it rewrites a metrics file (through a temporary file and a rename,
+/// so readers never see a partial snapshot) suitable for the node exporter's
+/// textfile collector. It can also serve GET /metrics over HTTP on a
+/// loopback port for a Prometheus server to scrape directly.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    /// @brief Constructor.
+    /// @param registry the counters to publish.
+    /// @param period how often the metrics file is rewritten.
+    MetricsExporter(const MetricsRegistry& registry, std::chrono::milliseconds period)
+        :
+        m_registry(registry),
+        m_period(period),
+        m_path(),
+        m_listenFd(-1),
+        m_stop(false),
+        m_thread()
+    {}
+
+    ~MetricsExporter()
+    {
+        m_stop.store(true, std::memory_order_relaxed);
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+        if (m_listenFd >= 0)
+        {
+            close(m_listenFd);
+        }
+    }
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    MetricsExporter( const MetricsExporter& ) = delete;
+    MetricsExporter( MetricsExporter&& ) = delete;
+    MetricsExporter& operator=( MetricsExporter&& ) = delete;
+    MetricsExporter& operator=( const MetricsExporter& ) = delete;
+
+    /// @brief Publishes to a file. Must be called before Start().
+    void WriteFile(const std::string& path)
+    {
+        m_path = path;
+    }
+
+    /// @brief Serves HTTP on 127.0.0.1:port. Must be called before Start().
+    void Listen(unsigned short port)
+    {
+        m_listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (m_listenFd < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "MetricsExporter: socket");
+        }
+        int one = 1;
+        setsockopt(m_listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(m_listenFd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0
+            || listen(m_listenFd, 8) < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "MetricsExporter: bind");
+        }
+    }
+
+    /// @brief Starts the exporter thread.
+    void Start()
+    {
+        m_thread = std::thread(&MetricsExporter::Run, this);
+    }
+
+protected:
+    void Run()
+    {
+        auto nextWrite = std::chrono::steady_clock::now();
+        while (!m_stop.load(std::memory_order_relaxed))
+        {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= nextWrite)
+            {
+                if (!m_path.empty())
+                {
+                    Publish();
+                }
+                nextWrite = now + m_period;
+            }
+
+            int timeoutMs = static_cast<int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(nextWrite - now).count()) + 1;
+            if (m_listenFd < 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+                continue;
+            }
+            struct pollfd pfd = {m_listenFd, POLLIN, 0};
+            if (poll(&pfd, 1, timeoutMs) > 0)
+            {
+                Serve();
+            }
+        }
+    }
+
+    /// @brief Writes a snapshot to the metrics file.
+    void Publish()
+    {
+        std::string text = m_registry.Format();
+        std::string tmpPath = m_path + ".tmp";
+        FILE* file = fopen(tmpPath.c_str(), "w");
+        if (file == nullptr)
+        {
+            return;
+        }
+        bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+        if (fclose(file) == 0 && written)
+        {
+            rename(tmpPath.c_str(), m_path.c_str());
+        }
+    }
+
+    /// @brief Answers one HTTP request with a fresh snapshot. Any path is
+    /// treated as /metrics.
+    void Serve()
+    {
+        int fd = accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+        // Read (and ignore) the request, without letting a slow client stall us
+        struct timeval timeout = {0, 100000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        char request[1024];
+        if (recv(fd, request, sizeof(request), 0) > 0)
+        {
+            std::string body = m_registry.Format();
+            std::string response = "HTTP/1.0 200 OK\r\n"
+                                   "Content-Type: text/plain; version=0.0.4\r\n"
+                                   "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                                   "Connection: close\r\n\r\n" + body;
+            size_t sent = 0;
+            while (sent < response.size())
+            {
+                ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0)
+                {
+                    break;
+                }
+                sent += n;
+            }
+        }
+        close(fd);
+    }
+
+    const MetricsRegistry&    m_registry;
+    std::chrono::milliseconds m_period;
+    std::string               m_path;
+    int                       m_listenFd;
+    std::atomic<bool>         m_stop;
+    std::thread               m_thread;
+};
+
+//------------------------------------------------------------------------------
+// End of file
+//------------------------------------------------------------------------------
+#endif // METRICS_H_
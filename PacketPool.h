@@ -0,0 +1,189 @@
+#ifndef PACKETPOOL_H_
+#define PACKETPOOL_H_
+//------------------------------------------------------------------------------
+//
+// Project: Hack2018
+// Module: PacketPool
+// File: PacketPool.h
+//
+//------------------------------------------------------------------------------
+/// @file
+/// @brief This file contains the PacketPool class template.
+/// The pool is a preallocated array of cache-line aligned packet slots handed
+/// out as small integer handles.
+///
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// System include files.
+//------------------------------------------------------------------------------
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+//------------------------------------------------------------------------------
+// Project include files.
+//------------------------------------------------------------------------------
+#include "CacheLine.h"
+
+/// @brief Index of a slot in a PacketPool.
+typedef uint32_t PacketHandle;
+
+/// @brief Handle value that never refers to a slot.
+const PacketHandle INVALID_PACKET_HANDLE = 0xffffffff;
+
+//------------------------------------------------------------------------------
+//
+template<typename Meta> class PacketPool : public CacheAligned
+//
+/// @brief This class owns a fixed number of packet slots, each holding up to
+/// SlotSize() bytes of packet data plus a Meta record kept in a separate
+/// array so that metadata scans do not pull payload into the cache. Data
+/// slots are rounded up to whole cache lines and live in one mapping that is
+/// allocated once at construction.
+///
+/// Allocate() and Free() are lock-free and may be called from any thread; the
+/// free list is a tagged Treiber stack, so recently freed (cache-hot) slots
+/// are reused first.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    /// @brief Constructor.
+    /// @param slotCount the number of slots in the pool.
+    /// @param dataSize the number of data bytes each slot must hold.
+    PacketPool(uint32_t slotCount, size_t dataSize)
+        :
+        m_slotCount(slotCount),
+        m_slotSize((dataSize + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1)),
+        m_mapSize(static_cast<size_t>(slotCount) * m_slotSize),
+        m_data(nullptr),
+        m_meta(new Meta[slotCount]()),
+        m_next(new std::atomic<uint32_t>[slotCount]),
+        m_head(0)
+    {
+        if (slotCount == 0 || slotCount >= INVALID_PACKET_HANDLE)
+        {
+            throw std::invalid_argument("PacketPool: bad slot count");
+        }
+
+        void* map = mmap(nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED)
+        {
+            throw std::bad_alloc();
+        }
+        m_data = static_cast<unsigned char*>(map);
+
+        for (uint32_t i = 0; i < slotCount; ++i)
+        {
+            m_next[i].store(i + 1 < slotCount ? i + 1 : INVALID_PACKET_HANDLE, std::memory_order_relaxed);
+        }
+        m_head.store(Pack(0, 0), std::memory_order_release);
+    }
+
+    ~PacketPool()
+    {
+        munmap(m_data, m_mapSize);
+    }
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    PacketPool( const PacketPool& ) = delete;
+    PacketPool( PacketPool&& ) = delete;
+    PacketPool& operator=( PacketPool&& ) = delete;
+    PacketPool& operator=( const PacketPool& ) = delete;
+
+    /// @brief Takes a free slot from the pool.
+    /// @return the slot handle, or INVALID_PACKET_HANDLE if the pool is empty.
+    PacketHandle Allocate()
+    {
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        while (true)
+        {
+            PacketHandle index = Index(head);
+            if (index == INVALID_PACKET_HANDLE)
+            {
+                return INVALID_PACKET_HANDLE;
+            }
+            uint32_t next = m_next[index].load(std::memory_order_relaxed);
+            if (m_head.compare_exchange_weak(head, Pack(next, Tag(head) + 1),
+                                             std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                return index;
+            }
+        }
+    }
+
+    /// @brief Returns a slot to the pool.
+    /// @param handle a handle previously obtained from Allocate().
+    void Free(PacketHandle handle)
+    {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        do
+        {
+            m_next[handle].store(Index(head), std::memory_order_relaxed);
+        } while (!m_head.compare_exchange_weak(head, Pack(handle, Tag(head) + 1),
+                                               std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    /// @brief Obtains the data area of a slot.
+    unsigned char* Data(PacketHandle handle) const
+    {
+        return m_data + static_cast<size_t>(handle) * m_slotSize;
+    }
+
+    /// @brief Obtains the metadata record of a slot.
+    Meta& Info(PacketHandle handle) const
+    {
+        return m_meta[handle];
+    }
+
+    /// @brief Obtains the (cache-line rounded) number of data bytes per slot.
+    size_t SlotSize() const
+    {
+        return m_slotSize;
+    }
+
+    /// @brief Obtains the total number of slots.
+    uint32_t Capacity() const
+    {
+        return m_slotCount;
+    }
+
+protected:
+    static uint64_t Pack(uint32_t index, uint32_t tag)
+    {
+        return (static_cast<uint64_t>(tag) << 32) | index;
+    }
+
+    static uint32_t Index(uint64_t head)
+    {
+        return static_cast<uint32_t>(head);
+    }
+
+    static uint32_t Tag(uint64_t head)
+    {
+        return static_cast<uint32_t>(head >> 32);
+    }
+
+    const uint32_t                            m_slotCount;
+    const size_t                              m_slotSize;
+    const size_t                              m_mapSize;
+    unsigned char*                            m_data;
+    std::unique_ptr<Meta[]>                   m_meta;
+    std::unique_ptr<std::atomic<uint32_t>[]>  m_next;
+    // The free list head is a slot index plus an ABA tag
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> m_head;
+};
+
+//------------------------------------------------------------------------------
+// End of file
+//------------------------------------------------------------------------------
+#endif // PACKETPOOL_H_
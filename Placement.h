@@ -0,0 +1,208 @@
+#ifndef PLACEMENT_H_
+#define PLACEMENT_H_
+//------------------------------------------------------------------------------
+//
+// Project: Hack2018
+// Module: Placement
+// File: Placement.h
+//
+//------------------------------------------------------------------------------
+/// @file
+/// @brief This file contains helpers to place threads on CPUs and memory on
+/// NUMA nodes: CPU list parsing, topology lookups in sysfs, thread pinning,
+/// SCHED_FIFO, and the NumaScope memory policy guard. They use the raw
+/// set_mempolicy/mbind system calls, so libnuma is not needed.
+///
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// System include files.
+//------------------------------------------------------------------------------
+#include <string>
+#include <system_error>
+#include <vector>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+
+//------------------------------------------------------------------------------
+// Project include files.
+//------------------------------------------------------------------------------
+
+/// @brief Highest NUMA node number the helpers handle, plus one.
+const unsigned int MAX_NUMA_NODES = 64;
+
+/// @brief Parses a CPU list such as "2,4-7".
+/// @param cpus receives the CPUs in the order given.
+/// @return false if the list is malformed.
+inline bool ParseCpuList(const std::string& text, std::vector<unsigned int>& cpus)
+{
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        size_t end = text.find(',', pos);
+        std::string item = text.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        pos = (end == std::string::npos) ? text.size() : end + 1;
+
+        char* rest = nullptr;
+        unsigned long first = strtoul(item.c_str(), &rest, 10);
+        unsigned long last = first;
+        if (rest == item.c_str())
+        {
+            return false;
+        }
+        if (*rest == '-')
+        {
+            const char* from = rest + 1;
+            last = strtoul(from, &rest, 10);
+            if (rest == from || last < first)
+            {
+                return false;
+            }
+        }
+        if (*rest != '\0' || last >= CPU_SETSIZE)
+        {
+            return false;
+        }
+        for (unsigned long cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back(static_cast<unsigned int>(cpu));
+        }
+    }
+    return !cpus.empty();
+}
+
+/// @brief Finds the NUMA node of a CPU.
+/// @return the node, or -1 if the system does not say.
+inline int CpuNumaNode(unsigned int cpu)
+{
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR* dir = opendir(path.c_str());
+    if (dir == nullptr)
+    {
+        return -1;
+    }
+    int node = -1;
+    while (struct dirent* entry = readdir(dir))
+    {
+        if (sscanf(entry->d_name, "node%d", &node) == 1)
+        {
+            break;
+        }
+        node = -1;
+    }
+    closedir(dir);
+    return node;
+}
+
+/// @brief Finds the NUMA node a network interface's device is attached to.
+/// @return the node, or -1 for virtual interfaces and non-NUMA systems.
+inline int InterfaceNumaNode(const std::string& ifceName)
+{
+    std::string path = "/sys/class/net/" + ifceName + "/device/numa_node";
+    FILE* file = fopen(path.c_str(), "r");
+    if (file == nullptr)
+    {
+        return -1;
+    }
+    int node = -1;
+    if (fscanf(file, "%d", &node) != 1)
+    {
+        node = -1;
+    }
+    fclose(file);
+    return node;
+}
+
+/// @brief Restricts the calling thread to one CPU.
+inline void PinCurrentThread(unsigned int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int status = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (status != 0)
+    {
+        throw std::system_error(status, std::generic_category(), "pthread_setaffinity_np");
+    }
+}
+
+/// @brief Moves the calling thread to SCHED_FIFO at the given priority.
+inline void SetRealtimePriority(int priority)
+{
+    struct sched_param param;
+    param.sched_priority = priority;
+    int status = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (status != 0)
+    {
+        throw std::system_error(status, std::generic_category(), "SCHED_FIFO");
+    }
+}
+
+/// @brief Prefers a NUMA node for the pages of an existing mapping, for
+/// faults from any thread. Call before the pages are first touched.
+/// @return false if the kernel refused, e.g. without NUMA support.
+inline bool PreferNumaNode(void* addr, size_t len, int node)
+{
+    if (node < 0 || node >= static_cast<int>(MAX_NUMA_NODES))
+    {
+        return false;
+    }
+    unsigned long mask = 1ul << node;
+    return syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, MAX_NUMA_NODES + 1, 0) == 0;
+}
+
+//------------------------------------------------------------------------------
+//
+class NumaScope
+//
+/// @brief This class makes the calling thread prefer a NUMA node for the
+/// memory it allocates and first touches while the object exists, then
+/// restores the default (local) policy. A node of -1 leaves the policy alone.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    explicit NumaScope(int node)
+        :
+        m_active(false)
+    {
+        if (node >= 0 && node < static_cast<int>(MAX_NUMA_NODES))
+        {
+            unsigned long mask = 1ul << node;
+            m_active = syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, MAX_NUMA_NODES + 1) == 0;
+        }
+    }
+
+    ~NumaScope()
+    {
+        if (m_active)
+        {
+            syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0);
+        }
+    }
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    NumaScope( const NumaScope& ) = delete;
+    NumaScope( NumaScope&& ) = delete;
+    NumaScope& operator=( NumaScope&& ) = delete;
+    NumaScope& operator=( const NumaScope& ) = delete;
+
+protected:
+    bool m_active;
+};
+
+//------------------------------------------------------------------------------
+// End of file
+//------------------------------------------------------------------------------
+#endif // PLACEMENT_H_
@@ -0,0 +1,281 @@
+#ifndef RINGBUFFER_H_
+#define RINGBUFFER_H_
+//------------------------------------------------------------------------------
+//
+// Project: Hack2018
+// Module: RingBuffer
+// File: RingBuffer.h
+//
+//------------------------------------------------------------------------------
+/// @file
+/// @brief This file contains the RingBuffer class template.
+/// The buffer is a contiguous FIFO with the subset of the std::list interface
+/// that ThreadSafeQueue uses, so it can stand in as the queue's storage.
+///
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// System include files.
+//------------------------------------------------------------------------------
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <stddef.h>
+
+//------------------------------------------------------------------------------
+// Project include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//
+template<typename T> class RingBuffer
+//
+/// @brief This class keeps its items in one array allocated by Reserve(), so
+/// pushing and popping at the ends does not touch the allocator. Should an
+/// item be pushed when the array is full, the array doubles; a bounded owner
+/// that makes room first never lets that happen. Erasing from the middle
+/// shifts the items behind it forward. Not thread safe.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    typedef T value_type;
+
+    //--------------------------------------------------------------------------
+    //
+    class iterator
+    //
+    /// @brief Forward iterator over the items, oldest first.
+    ///
+    //--------------------------------------------------------------------------
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T                         value_type;
+        typedef ptrdiff_t                 difference_type;
+        typedef T*                        pointer;
+        typedef T&                        reference;
+
+        iterator(RingBuffer* ring, size_t index)
+            :
+            m_ring(ring),
+            m_index(index)
+        {}
+
+        T& operator*() const
+        {
+            return m_ring->At(m_index);
+        }
+
+        T* operator->() const
+        {
+            return &m_ring->At(m_index);
+        }
+
+        iterator& operator++()
+        {
+            ++m_index;
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator previous = *this;
+            ++m_index;
+            return previous;
+        }
+
+        bool operator==(const iterator& rhs) const
+        {
+            return m_index == rhs.m_index && m_ring == rhs.m_ring;
+        }
+
+        bool operator!=(const iterator& rhs) const
+        {
+            return !(*this == rhs);
+        }
+
+    private:
+        friend class RingBuffer;
+
+        RingBuffer* m_ring;
+        size_t      m_index;    // from the oldest item
+    };
+
+    RingBuffer()
+        :
+        m_slots(),
+        m_capacity(0),
+        m_head(0),
+        m_size(0)
+    {}
+
+    ~RingBuffer()
+    {
+        clear();
+    }
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    RingBuffer( const RingBuffer& ) = delete;
+    RingBuffer( RingBuffer&& ) = delete;
+    RingBuffer& operator=( RingBuffer&& ) = delete;
+    RingBuffer& operator=( const RingBuffer& ) = delete;
+
+    /// @brief Allocates room for at least capacity items, keeping any
+    /// already held.
+    void Reserve(size_t capacity)
+    {
+        if (capacity <= m_capacity)
+        {
+            return;
+        }
+        std::unique_ptr<Slot[]> slots(new Slot[capacity]);
+        for (size_t i = 0; i < m_size; ++i)
+        {
+            new (&slots[i]) T(std::move(At(i)));
+            At(i).~T();
+        }
+        m_slots = std::move(slots);
+        m_capacity = capacity;
+        m_head = 0;
+    }
+
+    /// @brief Obtains the number of items the array holds without growing.
+    size_t Capacity() const
+    {
+        return m_capacity;
+    }
+
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    T& front()
+    {
+        return At(0);
+    }
+
+    iterator begin()
+    {
+        return iterator(this, 0);
+    }
+
+    iterator end()
+    {
+        return iterator(this, m_size);
+    }
+
+    void push_back(const T& item)
+    {
+        Grow();
+        new (&m_slots[Wrap(m_head + m_size)]) T(item);
+        ++m_size;
+    }
+
+    void push_back(T&& item)
+    {
+        Grow();
+        new (&m_slots[Wrap(m_head + m_size)]) T(std::move(item));
+        ++m_size;
+    }
+
+    void pop_front()
+    {
+        At(0).~T();
+        m_head = Wrap(m_head + 1);
+        --m_size;
+    }
+
+    /// @brief Removes the item at it.
+    /// @return an iterator to the item that followed it.
+    iterator erase(iterator it)
+    {
+        for (size_t i = it.m_index; i + 1 < m_size; ++i)
+        {
+            At(i) = std::move(At(i + 1));
+        }
+        At(m_size - 1).~T();
+        --m_size;
+        return it;
+    }
+
+    /// @brief Moves every item of other onto the end of this one, leaving
+    /// other empty. When this is empty the two just swap arrays; otherwise
+    /// the items are moved one by one.
+    /// @param pos must be end().
+    void splice(iterator pos, RingBuffer& other)
+    {
+        (void)pos;
+        if (&other == this)
+        {
+            return;
+        }
+        if (m_size == 0)
+        {
+            std::swap(m_slots, other.m_slots);
+            std::swap(m_capacity, other.m_capacity);
+            std::swap(m_head, other.m_head);
+            std::swap(m_size, other.m_size);
+            return;
+        }
+        Reserve(m_size + other.m_size);
+        while (!other.empty())
+        {
+            push_back(std::move(other.front()));
+            other.pop_front();
+        }
+    }
+
+    /// @brief Destroys every item, keeping the array.
+    void clear()
+    {
+        while (m_size)
+        {
+            pop_front();
+        }
+        m_head = 0;
+    }
+
+protected:
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+
+    size_t Wrap(size_t index) const
+    {
+        return index >= m_capacity ? index - m_capacity : index;
+    }
+
+    T& At(size_t index)
+    {
+        return *reinterpret_cast<T*>(&m_slots[Wrap(m_head + index)]);
+    }
+
+    void Grow()
+    {
+        if (m_size == m_capacity)
+        {
+            Reserve(m_capacity ? 2 * m_capacity : 16);
+        }
+    }
+
+    std::unique_ptr<Slot[]> m_slots;
+    size_t                  m_capacity;
+    size_t                  m_head;     // slot of the oldest item
+    size_t                  m_size;
+};
+
+//------------------------------------------------------------------------------
+// End of file
+//------------------------------------------------------------------------------
+#endif // RINGBUFFER_H_
@@ -9,66 +9,278 @@ extern "C" {
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <linux/net_tstamp.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <sys/resource.h>
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 #include <time.h>
 #include <net/if.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <signal.h>
 #include <cstring>
 }
 
 #include "ThreadSafeQueue.h"
+#include "JitterBuffer.h"
+#include "PacketPool.h"
+#include "SpscRing.h"
+#include "IoUring.h"
+#include "XdpSocket.h"
+#include "Metrics.h"
+#include "Log.h"
+#include "LegQuality.h"
+#include "Placement.h"
 //#include "ThreadSafeSet.h"
 #include <thread>
 #include <stdint.h>
-#include <set>
-#include <mutex>
-#include <condition_variable>
 #include <algorithm>
 #include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
 
 namespace
 {
     const int RTP_PACKET_SIZE{1328};
     const int MAXBUFSIZE{65536};
 
-    const char *multicast_ip = "239.99.1.1";
-    short multicast_port = 5000;
-
-    std::mutex m_mutex;
-//    std::mutex m_condVariableMutex;
-    std::condition_variable m_condVariable;
-    int nextSeqToPlay{0};
-    bool play{false};
+    // Batched receive: datagrams pulled per recvmmsg() call, and how many
+    // batches one leg may take per readiness event before others get a turn.
+    const unsigned int DEFAULT_RX_BATCH{64};
+    const unsigned int RX_BATCHES_PER_EVENT{4};
+    // recvmmsg() takes at most UIO_MAXIOV messages per call
+    const unsigned long MAX_RX_BATCH{1024};
+
+    // Batched transmit: packets handed to one sendmmsg() call, and the limits
+    // on a single UDP GSO (UDP_SEGMENT) super-datagram.
+    const unsigned int TX_BATCH{64};
+    const unsigned int GSO_MAX_SEGMENTS{64};
+    const unsigned int GSO_MAX_BYTES{65507};
+
+    // Packet slots shared by all legs, sized per leg; at our bitrates this
+    // holds several seconds of packets, and receivers drop when it runs dry.
+    const uint32_t PACKET_POOL_SLOTS_PER_LEG{8192};
+
+    // The player wakes on its own schedule rather than per received packet.
+    const std::chrono::microseconds PLAYOUT_TICK{1000};
+
+    // Seamless merge (SMPTE 2022-7 style): every packet is released exactly
+    // one maximum path differential delay after its first copy arrived.
+    // Packets further than MAX_DROPOUT ahead or MAX_MISORDER behind the
+    // playout point are treated as a sequence discontinuity.
+    const std::chrono::microseconds DEFAULT_MAX_SKEW{50000};
+    const int MAX_DROPOUT{3000};
+    const int MAX_MISORDER{100};
+
+    // RTP-timestamp paced output. The MPEG-TS RTP clock is 90 kHz (RFC 2250).
+    // Packets leave PACING_DELAY after their merge release time on average;
+    // the RTP-to-monotonic mapping is re-anchored when a launch time drifts
+    // outside [release, release + 2 * PACING_DELAY]. With SO_TXTIME, packets
+    // are handed to the kernel up to TXTIME_LOOKAHEAD before they are due;
+    // otherwise the player sends anything due within PACING_SLACK.
+    const uint32_t RTP_CLOCK_RATE{90000};
+    const std::chrono::microseconds DEFAULT_PACING_DELAY{10000};
+    const uint64_t TXTIME_LOOKAHEAD_NS{2000000};
+    const uint64_t PACING_SLACK_NS{50000};
+    const size_t PACING_QUEUE_SLOTS{16384};
+
+    // Handles each receiver leg can have in flight to the player
+    const size_t LEG_RING_SLOTS{8192};
+
+    // Event loop threads servicing every leg and session in the process
+    const unsigned int DEFAULT_IO_THREADS{2};
+    const unsigned long MAX_IO_THREADS{1024};
+    const int MAX_EPOLL_EVENTS{64};
+
+    // Spin-then-park: with a spin budget, an event loop polls without
+    // blocking until it has been idle that long, then parks in epoll or
+    // io_uring. While it spins, receive sockets busy poll the device queue
+    // for up to SOCKET_BUSY_POLL_US per call (SO_BUSY_POLL).
+    const unsigned int DEFAULT_SPIN_US{0};
+    const int SOCKET_BUSY_POLL_US{50};
+
+    // io_uring backend: submission queue size per event loop, provided
+    // receive buffers per leg, and sends a player may have in flight
+    const unsigned int URING_ENTRIES{1024};
+    const uint16_t RX_URING_BUFFERS{512};
+    const unsigned int TX_URING_INFLIGHT{256};
+    // A multishot recvmsg lays each datagram out in its buffer after a
+    // header and the control messages (the receive timestamp); pool slots
+    // grow by this much to make room
+    const unsigned int RX_URING_HEADROOM{sizeof(struct io_uring_recvmsg_out) + CMSG_SPACE(sizeof(struct timespec))};
+
+    // TPACKET_V3 capture ring per leg: 16 x 256 KB blocks, each handed to
+    // user space when full or after PACKET_RING_RETIRE_MS at the latest.
+    const unsigned int PACKET_RING_BLOCK_SIZE{256 * 1024};
+    const unsigned int PACKET_RING_BLOCKS{16};
+    const unsigned int PACKET_RING_FRAME_SIZE{2048};
+    const unsigned int PACKET_RING_RETIRE_MS{1};
+
+    // AF_XDP: the packet pool doubles as the UMEM, so its slots become
+    // XDP_FRAME_SIZE frames. Frames lent to the kernel and descriptors taken
+    // per readiness event, per interface.
+    const uint32_t XDP_FRAME_SIZE{2048};
+    const uint32_t XDP_RING_SIZE{2048};
+    const uint32_t XDP_RX_BATCH{64};
+    const uint32_t XDP_MAX_FLOWS{1024};
+    const uint32_t XDP_MAX_QUEUES{64};
+
+    // How often the metrics file is rewritten
+    const std::chrono::milliseconds METRICS_PERIOD{1000};
+
+    // Upper bound on the skew, pacing delay and spin time options
+    const unsigned long MAX_OPTION_USEC{1000000};
+
+    // Defaults, matching the original two-leg demo set-up
+    const char* DEFAULT_IFCE = "enp1s0";
+    const char* DEFAULT_OUTPUT = "239.32.32.32:1234";
+    const char* DEFAULT_LEGS[] = {"239.2.41.22:1234", "239.2.41.33:1234"};
 }
 
-// Define a Hackathon RTP packet
+// Define a Hackathon RTP packet. The payload lives in a PacketPool slot; this
+// is the per-slot metadata.
 struct RtpHackPacket
 {
-    RtpHackPacket(unsigned char* data)
+    void Parse(const unsigned char* data, unsigned int len)
     {
         seqNumber = (data[2]<<8) + data[3];
+        rtpTimestamp = (static_cast<uint32_t>(data[4])<<24) | (data[5]<<16) | (data[6]<<8) | data[7];
+        length = len;
 //        printf("\nSeq Number %d\n", seqNumber);
-        std::memcpy(m_data, data, RTP_PACKET_SIZE);
     }
 
         bool operator<(const RtpHackPacket &rhs) const
         {
-            return seqNumber < rhs.seqNumber;
+            return SeqLess(seqNumber, rhs.seqNumber);
         }
 
-    int seqNumber;
-    unsigned char* m_data[RTP_PACKET_SIZE];
+    uint16_t seqNumber;
+    uint16_t offset;        // of the RTP header within the pool slot
+    unsigned int length;
+    uint32_t rtpTimestamp;
+    uint16_t leg;           // index of the leg among its player's legs
+    uint64_t arrivalNs;     // CLOCK_MONOTONIC
+    uint64_t releaseNs;     // CLOCK_MONOTONIC, when the merge let it go
+    uint64_t launchNs;      // CLOCK_MONOTONIC, 0 if unpaced
 };
 
 static const int desiredRcvBufSize = 128 * 1024 * 1024;
-std::set<RtpHackPacket> RxSet{};
+// Created in main() once the number of legs is known
+std::unique_ptr<PacketPool<RtpHackPacket>> RxPool;
+
+// Per-leg handoff from the thread servicing a Receiver to the one servicing
+// its Player
+typedef SpscRing<PacketHandle> LegRing;
+
+// How a leg's packets reach us
+enum class RxMode
+{
+    Socket,         // UDP socket, recvmmsg() or io_uring
+    PacketRing,     // AF_PACKET TPACKET_V3 capture ring
+    Xdp             // AF_XDP socket shared by every leg on the interface
+};
+
+// Something an event loop waits on to become readable
+class EventSource
+{
+public:
+    virtual ~EventSource() {}
+    virtual int Fd() const = 0;
+    virtual void OnReadable() = 0;
+};
 
 //***********************************************************************************
 // Helper Methods
 //***********************************************************************************
+static inline uint64_t MonotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+/// @brief Offset to subtract from a CLOCK_REALTIME time to put it on
+/// CLOCK_MONOTONIC, e.g. for kernel receive timestamps.
+static inline int64_t RealtimeToMonotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec - static_cast<int64_t>(MonotonicNs());
+}
+
+/// @brief Finds the kernel receive time (SO_TIMESTAMPNS) among the control
+/// messages of a received datagram.
+/// @param realtimeOffsetNs from RealtimeToMonotonicNs().
+/// @param stampNs receives the time on CLOCK_MONOTONIC, if there is one.
+static bool ReceiveStampNs(struct msghdr& hdr, int64_t realtimeOffsetNs, uint64_t& stampNs)
+{
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            stampNs = static_cast<uint64_t>(static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec
+                                            - realtimeOffsetNs);
+            return true;
+        }
+    }
+    return false;
+}
+
+/// @brief Duration between two stamps; kernel receive stamps may lie a
+/// little after our own clock readings.
+static inline uint64_t Elapsed(uint64_t fromNs, uint64_t toNs)
+{
+    return toNs > fromNs ? toNs - fromNs : 0;
+}
+
+/// @brief Obtains the RTP packet held in a pool slot.
+static inline unsigned char* PacketData(PacketHandle handle)
+{
+    return RxPool->Data(handle) + RxPool->Info(handle).offset;
+}
+
+/// @brief Queues a poll for readability of fd.
+/// @param multishot false for a poll that completes once, which unlike the
+/// multishot kind (Linux 5.13) works on every kernel with io_uring.
+static void ArmPollIn(IoUring& uring, uint32_t handlerId, int fd, bool multishot = true)
+{
+    struct io_uring_sqe* sqe = uring.GetSqe(handlerId, 0);
+    if (sqe == nullptr)
+    {
+        LOG_ERROR("io_uring submission queue full, fd %d not armed", fd);
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->poll32_events = POLLIN;
+}
+
+/// @brief Makes receive calls and epoll on fd busy poll the device queue
+/// for up to usec before sleeping. Raising it above net.core.busy_read
+/// needs CAP_NET_ADMIN, so failure is reported and otherwise ignored.
+static void EnableBusyPoll(int fd, int usec)
+{
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0)
+    {
+        printf("SO_BUSY_POLL on fd %d: %s\n", fd, strerror(errno));
+    }
+}
+
 static void SetRcvBufSize(int sock)
 {
     int status;
@@ -153,26 +365,43 @@ static void SetRcvBufSize(int sock)
 //***********************************************************************************
 // Receiver Class
 //***********************************************************************************
-class Receiver
+class Receiver : public EventSource, public IoHandler, public CacheAligned
 {
 public:
 
 
-    Receiver( const char *listen_ip, unsigned short listen_port, const char *ifceName, const char* stats_file)
-    : first{true}
-    , m_thread{}
+    Receiver( const char *listen_ip, unsigned short listen_port, const char *ifceName,
+              LegRing& ring,
+              unsigned int batchSize = DEFAULT_RX_BATCH,
+              RxMode mode = RxMode::Socket)
+    : m_ring(ring)
     , m_sock{-1}
     , saddr{}
     , imreq{}
     , socklen{}
-    , m_myFile{}
-    , m_rxPkts{}
-    , m_buffer{}
+    , m_batchSize{batchSize ? batchSize : 1}
+    , m_slots(m_batchSize, INVALID_PACKET_HANDLE)
+    , m_iovecs(m_batchSize)
+    , m_msgs(m_batchSize)
+    , m_controls(m_batchSize)
+    , m_uring{nullptr}
+    , m_ioId{0}
+    , m_uringMsg{}
+    , m_bufRing{}
+    , m_bufHandles{}
+    , m_starved{}
+    , m_rearm{false}
+    , m_fallback{}
+    , m_packetSock{-1}
+    , m_ringMap{nullptr}
+    , m_block{0}
+    , m_received{}
+    , m_malformed{}
+    , m_ringFull{}
+    , m_poolEmpty{}
+    , m_quality{RTP_CLOCK_RATE}
+    , m_pickup{}
     {
-        m_rxPkts = 0;
-        m_myFile.open (stats_file, std::ios_base::out);
-        m_myFile << "Stats file for multicast " << listen_ip << ", port " << listen_port << std::endl;
-
         int status;
 
         // set content of struct saddr and imreq to zero
@@ -205,19 +434,26 @@ public:
                 exit(1);
         }
 
-//        struct timeval timeout;
-//        timeout.tv_sec = 0;
-//        timeout.tv_usec = 10;
-//        status = setsockopt(m_sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
-//
-//        if (status < 0 )
-//        {
-//                printf("Error setting socket timeout\n\n");
-//                exit(1);
-//        }
+        // Have the kernel stamp each datagram as it arrives, so its arrival
+        // time does not include however long this thread took to wake
+        if (mode == RxMode::Socket
+            && setsockopt(m_sock, SOL_SOCKET, SO_TIMESTAMPNS, &yes, sizeof(yes)) < 0)
+        {
+            printf("SO_TIMESTAMPNS unavailable, using user space arrival times: %s\n", strerror(errno));
+        }
+
+        // The event loop waits for readiness; reads never block
+        if (fcntl(m_sock, F_SETFL, fcntl(m_sock, F_GETFL) | O_NONBLOCK) < 0)
+        {
+                printf("Error setting socket non-blocking\n\n");
+                exit(1);
+        }
 
         saddr.sin_family = AF_INET;
-        saddr.sin_port = htons(listen_port);
+        // With a capture ring or AF_XDP this socket only holds the group
+        // membership; on an ephemeral port the kernel drops the UDP copies
+        // early
+        saddr.sin_port = htons(mode == RxMode::Socket ? listen_port : 0);
         saddr.sin_addr.s_addr = htonl(INADDR_ANY); // bind socket to any interface
         status = bind(m_sock, (struct sockaddr *)&saddr, sizeof(struct sockaddr_in));
         if ( status < 0 )
@@ -269,393 +505,2580 @@ public:
 
         socklen = sizeof(struct sockaddr_in);
 
-        printf("Listening for multicast packets on %s:%u\n", listen_ip, listen_port);
+        for (unsigned int i = 0; i < m_batchSize; ++i)
+        {
+            memset(&m_msgs[i], 0, sizeof(struct mmsghdr));
+            m_msgs[i].msg_hdr.msg_iov = &m_iovecs[i];
+            m_msgs[i].msg_hdr.msg_iovlen = 1;
+            m_msgs[i].msg_hdr.msg_control = m_controls[i].buf;
+        }
+
+        if (mode == RxMode::PacketRing)
+        {
+            OpenPacketRing(listen_ip, listen_port, ifceName);
+        }
+
+        printf("Listening for multicast packets on %s:%u%s\n", listen_ip, listen_port,
+               mode == RxMode::PacketRing ? " (TPACKET_V3 ring)" : mode == RxMode::Xdp ? " (AF_XDP)" : "");
     }
 
-    void Start()
+    int Fd() const override
     {
-        m_thread = std::thread{&Receiver::Execute, this};
-        printf("\nReceiving Packets\n");
+        return m_packetSock >= 0 ? m_packetSock : m_sock;
     }
 
-    void Execute()
+    /// @brief Called by the event loop when the socket is readable. Drains up
+    /// to RX_BATCHES_PER_EVENT batches straight into pool slots.
+    void OnReadable() override
     {
-        printf("\nStarting Thread\n");
-
-        while (true)
+        if (m_ringMap)
         {
-            // receive packet from socket
-            int status = recvfrom(m_sock, m_buffer, MAXBUFSIZE, 0,  (struct sockaddr *)&saddr, &socklen);
+            ReadPacketRing();
+            return;
+        }
 
-            if (status < 0)
+        for (unsigned int batch = 0; batch < RX_BATCHES_PER_EVENT; ++batch)
+        {
+            // Receive straight into pool slots; refill the ones handed on
+            unsigned int ready = 0;
+            while (ready < m_batchSize)
             {
-//                printf("\nError reading data!\n");
-//                perror("recvfrom");
-//                exit(-1)
-                std::unique_lock<std::mutex> lck(m_mutex);
-                play = true;
-                m_condVariable.notify_all();
-                while (play) m_condVariable.wait(lck);
-
+                if (m_slots[ready] == INVALID_PACKET_HANDLE
+                    && (m_slots[ready] = RxPool->Allocate()) == INVALID_PACKET_HANDLE)
+                {
+                    break;
+                }
+                m_iovecs[ready].iov_base = RxPool->Data(m_slots[ready]);
+                m_iovecs[ready].iov_len = RxPool->SlotSize();
+                // The kernel sets this to the length it used
+                m_msgs[ready].msg_hdr.msg_controllen = sizeof(m_controls[ready].buf);
+                ++ready;
             }
-            else if (status == 0)
+            if (ready == 0)
             {
-                // No data. Sleep for a bit, then try again
-                printf("\nNo Data!\n");
-                std::unique_lock<std::mutex> lck(m_mutex);
-                play = true;
-                m_condVariable.notify_all();
-                while (play) m_condVariable.wait(lck);
+                // Pool exhausted; discard a datagram so the socket does not
+                // keep the loop spinning
+                unsigned char scratch[RTP_PACKET_SIZE];
+                recv(m_sock, scratch, sizeof(scratch), MSG_DONTWAIT);
+                ++m_poolEmpty;
+                LOG_WARNING("Packet pool empty, dropping packet");
+                return;
             }
-            else
-            {
- //               printf("\nGot Data!\n");
-//               printf("\nRead %d bytes!\n", status);
 
-                std::unique_lock<std::mutex> lck(m_mutex);
-                RtpHackPacket pkt{m_buffer};
-                m_myFile << ++m_rxPkts << std::endl;
+            // Take whatever is queued, without waiting
+            int status = recvmmsg(m_sock, m_msgs.data(), ready, MSG_DONTWAIT, NULL);
 
-//                if (first)
-//                {
-                    nextSeqToPlay = pkt.seqNumber;
-                    first = false;
-//                }
+            if (status < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                {
+                    LOG_ERROR("recvmmsg: %s", strerror(errno));
+                }
+                return;
+            }
 
-                auto ret = RxSet.insert(std::move(pkt));
-                if (ret.second)
+            uint64_t nowNs = MonotonicNs();
+            int64_t realtimeOffsetNs = RealtimeToMonotonicNs();
+            for (int i = 0; i < status; ++i)
+            {
+                uint64_t arrivalNs = nowNs;
+                if (ReceiveStampNs(m_msgs[i].msg_hdr, realtimeOffsetNs, arrivalNs))
                 {
-                    printf("Inserting packet %d\n", pkt.seqNumber);
-                    // trigger cond
-                    play = true;
-                    m_condVariable.notify_all();
-                    while (play) m_condVariable.wait(lck);
+                    m_pickup.Record(Elapsed(arrivalNs, nowNs));
                 }
-                else
+                if (Deliver(m_slots[i], 0, m_msgs[i].msg_len, m_msgs[i].msg_hdr.msg_flags, arrivalNs))
                 {
-                    printf("Packet already inserted");
-
+                    // The slot now belongs to the player
+                    m_slots[i] = INVALID_PACKET_HANDLE;
                 }
-                //m_mutex.unlock();
+            }
+
+            if (static_cast<unsigned int>(status) < ready)
+            {
+                // Socket drained
+                return;
             }
         }
     }
 
-private:
-
-    bool first;
-    std::thread m_thread;
-    int m_sock;
-    struct sockaddr_in saddr;
-    struct ip_mreq imreq;
-    socklen_t socklen;
-    std::ofstream m_myFile;
-    std::uint32_t m_rxPkts;
-    unsigned char m_buffer[MAXBUFSIZE];
-};
-
-//***********************************************************************************
-// Playout Class
-//***********************************************************************************
-class Player
-{
-public:
-
-    Player()
+    /// @brief Switches the leg to io_uring: a multishot recvmsg that fills
+    /// pool slots lent to the kernel as provided buffers, each datagram after
+    /// RX_URING_HEADROOM bytes of header and timestamp. Must be called
+    /// before the loop starts, instead of watching Fd().
+    /// @param sharedRing true if the kernel supports provided buffer rings.
+    /// @param fallback called with the leg should the kernel turn multishot
+    /// recvmsg down; it must have Fd() watched for readiness instead.
+    void Attach(IoUring& uring, bool sharedRing, std::function<void(EventSource&)> fallback)
     {
-        FILE *fin;
-        unsigned char pkt[188];
-        unsigned int pid_count[8192];
-        long long first_pcr27mhz = -1;
-        long first_pcrpos = -1;
-        unsigned int calc_pid = 0xffff;
-        int status;
-        struct in_addr iaddr;
-        const unsigned char ttl = 3;
-        const unsigned char one = 1;
-        long long total_sent = 0;
-        int loop_count = 0;
-        int i;
-        long filesize = 0;
-
-        multicast_ip = "239.32.32.32";
-        multicast_port = 1234;
-        const char *ifceName = "enp1s0";
-
-        memset(pid_count, 0, sizeof(pid_count));
-
-        // set content of struct saddr and imreq to zero
-        memset(&saddr, 0, sizeof(struct sockaddr_in));
-        memset(&iaddr, 0, sizeof(struct in_addr));
+        m_uring = &uring;
+        m_fallback = std::move(fallback);
+        m_ioId = uring.Register(*this);
+        if (m_ringMap)
+        {
+            // The capture ring is already shared memory; just wait for blocks
+            ArmPollIn(uring, m_ioId, m_packetSock);
+            return;
+        }
+        m_uringMsg.msg_controllen = CMSG_SPACE(sizeof(struct timespec));
+        m_bufRing.reset(new IoBufferRing{uring, static_cast<uint16_t>(m_ioId), RX_URING_BUFFERS, sharedRing});
+        m_bufHandles.assign(RX_URING_BUFFERS, INVALID_PACKET_HANDLE);
+        for (uint16_t bid = 0; bid < RX_URING_BUFFERS; ++bid)
+        {
+            Lend(bid);
+        }
+        m_bufRing->Publish();
+        ArmRecv();
+    }
 
-        // open a UDP socket
-        m_sock = socket(AF_INET, SOCK_DGRAM, 0);
-        if (m_sock < 0)
+    /// @brief Handles one multishot receive completion.
+    void OnCompletion(uint32_t, int32_t result, uint32_t flags) override
+    {
+        if (m_ringMap)
         {
-            perror("Error creating socket");
-            exit(-1);
+            ReadPacketRing();
+            if (!(flags & IORING_CQE_F_MORE))
+            {
+                ArmPollIn(*m_uring, m_ioId, m_packetSock);
+            }
+            return;
         }
 
-    int yes = 1;
-    status = setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+        if (flags & IORING_CQE_F_BUFFER)
+        {
+            uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+            PacketHandle handle = m_bufHandles[bid];
+            m_bufHandles[bid] = INVALID_PACKET_HANDLE;
+            if (result < 0 || !DeliverRecvmsg(handle))
+            {
+                RxPool->Free(handle);
+            }
+            Lend(bid);
+        }
+        else if (result == -EINVAL)
+        {
+            // Multishot recvmsg needs Linux 6.0; go back to recvmmsg
+            LOG_WARNING("io_uring recvmsg unsupported, leg falls back to recvmmsg");
+            Detach();
+            m_fallback(*this);
+            return;
+        }
+        else if (result < 0 && result != -ENOBUFS)
+        {
+            LOG_ERROR("io_uring recv error: %s", strerror(-result));
+        }
 
-    if (status < 0 )
-    {
-            printf("Error setting socket options\n\n");
-            exit(1);
+        if (!(flags & IORING_CQE_F_MORE))
+        {
+            // The kernel ended the multishot, e.g. when it ran out of buffers
+            m_rearm = true;
+        }
+        Refill();
     }
 
-    /* Bind to particular interface only (e.g. eth1) */
-    if ((status = setsockopt(m_sock, SOL_SOCKET, SO_BINDTODEVICE, ifceName, strlen(ifceName))) < 0)
+    /// @brief Lends the buffer ids the pool could not back earlier, and
+    /// rearms an ended multishot once the kernel has a buffer to select.
+    /// Also called from the event loop's ticks, so that a leg starved by an
+    /// empty pool recovers without spinning on -ENOBUFS meanwhile.
+    void Refill()
     {
-        perror("setsockopt() error for SO_BINDTODEVICE");
-        printf("%s\n", strerror(errno));
-        close(m_sock);
-        exit(-1);
-    }
+        if (!m_bufRing)
+        {
+            return;
+        }
+        while (!m_starved.empty() && Lend(m_starved.back()))
+        {
+            m_starved.pop_back();
+        }
+        m_bufRing->Publish();
 
-    saddr.sin_family = AF_INET;
-    saddr.sin_port = htons(0); // Use the first free port
-    saddr.sin_addr.s_addr = htonl(INADDR_ANY); // bind socket to any interface
-    status = bind(m_sock, (struct sockaddr *)&saddr, sizeof(struct sockaddr_in));
+        if (m_rearm && m_starved.size() < m_bufHandles.size())
+        {
+            m_rearm = false;
+            ArmRecv();
+        }
+    }
 
-    if ( status < 0 )
+    /// @brief Parses a received datagram and hands it to the player.
+    /// @param offset where the datagram starts within the slot.
+    /// @return true if the leg ring took the slot.
+    bool Deliver(PacketHandle handle, unsigned int offset, unsigned int len, int msgFlags, uint64_t arrivalNs)
     {
-        perror("Error binding socket to interface");
-        exit(0);
-    }
+        if (len < 12 || (msgFlags & MSG_TRUNC))
+        {
+            ++m_malformed;
+            LOG_WARNING("Dropping malformed packet of %u bytes", len);
+            return false;
+        }
 
-    iaddr.s_addr = htonl(INADDR_ANY); // use DEFAULT interface
+        RtpHackPacket& pkt = RxPool->Info(handle);
+        pkt.offset = static_cast<uint16_t>(offset);
+        pkt.Parse(RxPool->Data(handle) + offset, len);
+        pkt.arrivalNs = arrivalNs;
+        m_quality.Update(pkt.seqNumber, pkt.rtpTimestamp, arrivalNs);
 
-    // Set the outgoing interface to DEFAULT
-    status =setsockopt(m_sock, IPPROTO_IP, IP_MULTICAST_IF, &iaddr, sizeof(struct in_addr));
-    if (status < 0)
-    {
-        printf("Failed to set sock opt");
-        exit(0);
+        if (!m_ring.Push(handle))
+        {
+            ++m_ringFull;
+            LOG_WARNING("Leg ring full, dropping packet");
+            return false;
+        }
+        ++m_received;
+        return true;
     }
 
-    // Set multicast packet TTL to 3; default TTL is 1
-    status =setsockopt(m_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(unsigned char));
-    if (status < 0)
+    /// @brief Delivers a datagram received by multishot recvmsg, stamped
+    /// with the kernel receive time from its control messages.
+    bool DeliverRecvmsg(PacketHandle handle)
     {
-        printf("Failed to set sock opt");
-        exit(0);
+        unsigned char* buffer = RxPool->Data(handle);
+        const struct io_uring_recvmsg_out* out = reinterpret_cast<const struct io_uring_recvmsg_out*>(buffer);
+        unsigned int controlOffset = sizeof(*out) + m_uringMsg.msg_namelen;
+
+        struct msghdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_control = buffer + controlOffset;
+        hdr.msg_controllen = out->controllen;
+        uint64_t nowNs = MonotonicNs();
+        uint64_t arrivalNs = nowNs;
+        if (ReceiveStampNs(hdr, RealtimeToMonotonicNs(), arrivalNs))
+        {
+            m_pickup.Record(Elapsed(arrivalNs, nowNs));
+        }
+        return Deliver(handle, controlOffset + static_cast<unsigned int>(m_uringMsg.msg_controllen),
+                       out->payloadlen, static_cast<int>(out->flags), arrivalNs);
     }
 
-    // send multicast traffic to myself too
-    status = setsockopt(m_sock, IPPROTO_IP, IP_MULTICAST_LOOP, &one, sizeof(unsigned char));
-    if (status < 0)
+    /// @brief Exports the leg's counters under the given labels.
+    void RegisterMetrics(MetricsRegistry& metrics, const std::string& labels) const
     {
-        printf("Failed to set sock opt");
-        exit(0);
+        metrics.Add("rx_packets_total", "Packets received and handed to the merge", labels, m_received);
+        metrics.Add("rx_dropped_total", "Packets dropped on receive", labels + ",reason=\"malformed\"", m_malformed);
+        metrics.Add("rx_dropped_total", "Packets dropped on receive", labels + ",reason=\"ring_full\"", m_ringFull);
+        metrics.Add("rx_dropped_total", "Packets dropped on receive", labels + ",reason=\"pool_empty\"", m_poolEmpty);
+        metrics.Add("rx_pickup_delay_seconds", "Time from the kernel receive timestamp to the receiver reading the packet",
+                    labels, m_pickup);
+        m_quality.RegisterMetrics(metrics, labels);
     }
 
-    // set destination multicast address
-    saddr.sin_family = AF_INET;
-    saddr.sin_addr.s_addr = inet_addr(multicast_ip);
-    saddr.sin_port = htons(multicast_port);
-
-//    // sync byte                        8   0x47
-//    // Transport Error Indicator (TEI)  1   Set by demodulator if can't correct errors in the stream, to tell the demultiplexer that the packet has an uncorrectable error [11]
-//    // Payload Unit Start Indicator     1   1 means start of PES data or PSI otherwise zero only.
-//    // Transport Priority               1   1 means higher priority than other packets with the same PID.
-//    // PID                              13  Packet ID
-//    // Scrambling control               2   '00' = Not scrambled.   The following per DVB spec:[12]   '01' = Reserved for future use,   '10' = Scrambled with even key,   '11' = Scrambled with odd key
-//    // Adaptation field exist           2   01 = no adaptation fields, payload only, 10 = adaptation field only, 11 = adaptation field and payload
-//    // Continuity counter               4   Incremented only when a payload is present (i.e., adaptation field exist is 01 or 11)[13]
-//    // Adaptation field                 0 or more   Depends on flags
-//    // Payload Data                     0 or more   Depends on flags
-//
-//    // Adaptation Field Length                  8   Number of bytes in the adaptation field immediately following this byte
-//    // Discontinuity indicator                  1   Set to 1 if current TS packet is in a discontinuity state with respect to either the continuity counter or the program clock reference
-//    // Random Access indicator                  1   Set to 1 if the PES packet in this TS packet starts a video/audio sequence
-//    // Elementary stream priority indicator     1   1 = higher priority
-//    // PCR flag                                 1   1 means adaptation field does contain a PCR field
-//    // OPCR flag                                1   1 means adaptation field does contain an OPCR field
-//    // Splicing point flag                      1   1 means presence of splice countdown field in adaptation field
-//    // Transport private data flag              1   1 means presence of private data bytes in adaptation field
-//    // Adaptation field extension flag          1   1 means presence of adaptation field extension
-//
-//    // PCR                                      33+9    Program clock reference, stored in 6 octets in big-endian as 33 bits base, 6 bits padding, 9 bits extension.
-//    // OPCR                                     33+9    Original Program clock reference. Helps when one TS is copied into another
-//    // Splice countdown                         8   Indicates how many TS packets from this one a splicing point occurs (may be negative)
-//    // stuffing bytes                           variable
-//
+private:
 
+    /// @brief Takes the leg off the io_uring after its receive failed to
+    /// arm, returning the lent slots to the pool. No operation selects from
+    /// the buffer group any more, so the kernel never writes to them again.
+    void Detach()
+    {
+        for (PacketHandle handle : m_bufHandles)
+        {
+            if (handle != INVALID_PACKET_HANDLE)
+            {
+                RxPool->Free(handle);
+            }
+        }
+        m_bufHandles.clear();
+        m_starved.clear();
+        m_rearm = false;
+        m_bufRing.reset();
+        m_uring = nullptr;
     }
 
-    void Start()
+    /// @brief Backs buffer id bid with a fresh pool slot and stages it.
+    /// @return false if the pool is empty; the id is kept for a later retry.
+    bool Lend(uint16_t bid)
     {
-        m_thread = std::thread{&Player::Execute, this};
-        printf("Sending Packets on %s:%u\n", multicast_ip, multicast_port);
+        PacketHandle handle = RxPool->Allocate();
+        if (handle != INVALID_PACKET_HANDLE
+            && m_bufRing->Add(RxPool->Data(handle), static_cast<uint32_t>(RxPool->SlotSize()), bid))
+        {
+            m_bufHandles[bid] = handle;
+            return true;
+        }
+
+        if (handle != INVALID_PACKET_HANDLE)
+        {
+            RxPool->Free(handle);
+        }
+        if (std::find(m_starved.begin(), m_starved.end(), bid) == m_starved.end())
+        {
+            m_starved.push_back(bid);
+        }
+        return false;
     }
 
-    void Execute()
+    /// @brief Opens an AF_PACKET socket on the interface with a TPACKET_V3
+    /// ring, and a classic BPF filter passing only unfragmented UDP for the
+    /// leg's group and port.
+    void OpenPacketRing(const char* listen_ip, unsigned short listen_port, const char* ifceName)
     {
-        printf("\nStarting Playout Thread\n");
-
-        unsigned char tmp[MAXBUFSIZE];
-        static RtpHackPacket seqPlay{tmp};
+        // SOCK_DGRAM delivers from the IP header on, whatever the link type.
+        // Protocol 0 captures nothing until bind(), after the filter is set.
+        m_packetSock = socket(AF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (m_packetSock < 0)
+        {
+            perror("Error creating packet socket (needs CAP_NET_RAW)");
+            exit(-1);
+        }
 
-        static bool setFirstPacket{true};
-        static int gracePktCount{0};
-        static int retries{0};
-        while(true)
+        uint32_t group = ntohl(inet_addr(listen_ip));
+        struct sock_filter code[] = {
+            BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9),                     // IP protocol
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 8),
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 16),                    // destination address
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, group, 0, 6),
+            BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),                     // fragment offset
+            BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 4, 0),
+            BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),                    // IP header length
+            BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2),                     // UDP destination port
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, listen_port, 0, 1),
+            BPF_STMT(BPF_RET | BPF_K, 0xffff),
+            BPF_STMT(BPF_RET | BPF_K, 0),
+        };
+        struct sock_fprog filter;
+        filter.len = sizeof(code) / sizeof(code[0]);
+        filter.filter = code;
+        if (setsockopt(m_packetSock, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) < 0)
         {
-            std::set<RtpHackPacket>::iterator it{};
-            std::unique_lock<std::mutex> lck(m_mutex);
+            perror("setsockopt() error for SO_ATTACH_FILTER");
+            exit(-1);
+        }
 
-            while (!play) m_condVariable.wait(lck);
+        int version = TPACKET_V3;
+        if (setsockopt(m_packetSock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+        {
+            perror("setsockopt() error for PACKET_VERSION");
+            exit(-1);
+        }
 
-            if(setFirstPacket)
-            {
-                seqPlay.seqNumber = nextSeqToPlay;
-                printf("\nPacket to play is: %d\n", nextSeqToPlay);
-                setFirstPacket = false;
-            }
+        // Our own transmissions would otherwise show up too (e.g. on lo)
+        int one = 1;
+        setsockopt(m_packetSock, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+
+        struct tpacket_req3 req;
+        memset(&req, 0, sizeof(req));
+        req.tp_block_size = PACKET_RING_BLOCK_SIZE;
+        req.tp_block_nr = PACKET_RING_BLOCKS;
+        req.tp_frame_size = PACKET_RING_FRAME_SIZE;
+        req.tp_frame_nr = PACKET_RING_BLOCK_SIZE / PACKET_RING_FRAME_SIZE * PACKET_RING_BLOCKS;
+        req.tp_retire_blk_tov = PACKET_RING_RETIRE_MS;
+        if (setsockopt(m_packetSock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+        {
+            perror("setsockopt() error for PACKET_RX_RING");
+            exit(-1);
+        }
 
-            if (gracePktCount++ < 1000)
-            {
-                play = false;
-                m_condVariable.notify_all();
-            }
-            else
-            {
-                if((it = RxSet.find(seqPlay)) != RxSet.end())
-                {
-                    printf("\nFound packet to play! %d, %d\n", seqPlay.seqNumber, it->seqNumber);
-                    socklen_t socklen = sizeof(struct sockaddr_in);
+        void* map = mmap(nullptr, static_cast<size_t>(PACKET_RING_BLOCK_SIZE) * PACKET_RING_BLOCKS,
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, m_packetSock, 0);
+        if (map == MAP_FAILED)
+        {
+            map = mmap(nullptr, static_cast<size_t>(PACKET_RING_BLOCK_SIZE) * PACKET_RING_BLOCKS,
+                       PROT_READ | PROT_WRITE, MAP_SHARED, m_packetSock, 0);
+        }
+        if (map == MAP_FAILED)
+        {
+            perror("Error mapping packet ring");
+            exit(-1);
+        }
+        m_ringMap = static_cast<unsigned char*>(map);
+
+        struct sockaddr_ll addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sll_family = AF_PACKET;
+        addr.sll_protocol = htons(ETH_P_IP);
+        addr.sll_ifindex = if_nametoindex(ifceName);
+        if (bind(m_packetSock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0)
+        {
+            perror("Error binding packet socket to interface");
+            exit(-1);
+        }
+    }
+
+    /// @brief Walks every block the kernel has handed over, copies each UDP
+    /// payload into a pool slot stamped with its kernel receive time, and
+    /// returns the blocks.
+    void ReadPacketRing()
+    {
+        uint64_t nowNs = MonotonicNs();
+        int64_t realtimeOffsetNs = RealtimeToMonotonicNs();
+        while (true)
+        {
+            struct tpacket_block_desc* block = reinterpret_cast<struct tpacket_block_desc*>(
+                m_ringMap + static_cast<size_t>(m_block) * PACKET_RING_BLOCK_SIZE);
+            if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+            {
+                return;
+            }
+
+            unsigned char* frame = reinterpret_cast<unsigned char*>(block) + block->hdr.bh1.offset_to_first_pkt;
+            for (uint32_t i = 0; i < block->hdr.bh1.num_pkts; ++i)
+            {
+                struct tpacket3_hdr* hdr = reinterpret_cast<struct tpacket3_hdr*>(frame);
+                int64_t stampNs = static_cast<int64_t>(hdr->tp_sec) * 1000000000 + hdr->tp_nsec;
+                uint64_t arrivalNs = static_cast<uint64_t>(stampNs - realtimeOffsetNs);
+                m_pickup.Record(Elapsed(arrivalNs, nowNs));
+                CopyFromRing(frame + hdr->tp_net, hdr->tp_snaplen, arrivalNs);
+                frame += hdr->tp_next_offset;
+            }
+
+            __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+            m_block = (m_block + 1) % PACKET_RING_BLOCKS;
+        }
+    }
+
+    /// @brief Copies the UDP payload of a captured IP packet into a pool slot
+    /// and delivers it.
+    void CopyFromRing(const unsigned char* ip, uint32_t caplen, uint64_t arrivalNs)
+    {
+        if (caplen < 20)
+        {
+            return;
+        }
+        uint32_t ipHeaderLen = (ip[0] & 0x0f) * 4;
+        if (caplen < ipHeaderLen + 8)
+        {
+            return;
+        }
+        const unsigned char* udp = ip + ipHeaderLen;
+        uint32_t payloadLen = ((udp[4] << 8) | udp[5]) - 8;
+        if (payloadLen > caplen - ipHeaderLen - 8 || payloadLen > RxPool->SlotSize())
+        {
+            ++m_malformed;
+            LOG_WARNING("Dropping truncated packet of %u bytes", payloadLen);
+            return;
+        }
+
+        PacketHandle handle = RxPool->Allocate();
+        if (handle == INVALID_PACKET_HANDLE)
+        {
+            ++m_poolEmpty;
+            LOG_WARNING("Packet pool empty, dropping packet");
+            return;
+        }
+        memcpy(RxPool->Data(handle), udp + 8, payloadLen);
+        if (!Deliver(handle, 0, payloadLen, 0, arrivalNs))
+        {
+            RxPool->Free(handle);
+        }
+    }
+
+    void ArmRecv()
+    {
+        struct io_uring_sqe* sqe = m_uring->GetSqe(m_ioId, 0);
+        if (sqe == nullptr)
+        {
+            LOG_ERROR("io_uring submission queue full, leg not armed");
+            return;
+        }
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = m_sock;
+        sqe->addr = reinterpret_cast<uint64_t>(&m_uringMsg);
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = m_bufRing->GroupId();
+    }
+
+    // Room for an SCM_TIMESTAMPNS control message
+    union RxControl
+    {
+        char buf[CMSG_SPACE(sizeof(struct timespec))];
+        struct cmsghdr align;
+    };
+
+    LegRing& m_ring;
+    int m_sock;
+    struct sockaddr_in saddr;
+    struct ip_mreq imreq;
+    socklen_t socklen;
+    unsigned int m_batchSize;
+    std::vector<PacketHandle> m_slots;
+    std::vector<struct iovec> m_iovecs;
+    std::vector<struct mmsghdr> m_msgs;
+    std::vector<RxControl> m_controls;
+    // io_uring mode: the recvmsg template giving the buffer layout, the pool
+    // slot lent under each buffer id, the ids waiting for the pool to
+    // refill, and whether the multishot ended and waits for them
+    IoUring* m_uring;
+    uint32_t m_ioId;
+    struct msghdr m_uringMsg;
+    std::unique_ptr<IoBufferRing> m_bufRing;
+    std::vector<PacketHandle> m_bufHandles;
+    std::vector<uint16_t> m_starved;
+    bool m_rearm;
+    std::function<void(EventSource&)> m_fallback;
+    // Capture ring mode: the AF_PACKET socket, its TPACKET_V3 blocks, and
+    // the next block to read
+    int m_packetSock;
+    unsigned char* m_ringMap;
+    unsigned int m_block;
+    // Written by the leg's event loop thread only
+    Counter m_received;
+    Counter m_malformed;
+    Counter m_ringFull;
+    Counter m_poolEmpty;
+    LegQuality m_quality;
+    LatencyHistogram m_pickup;
+};
+
+//***********************************************************************************
+// XDP Port Class
+//***********************************************************************************
+// The AF_XDP socket for every AF_XDP leg on one interface. Its UMEM is the
+// packet pool, so a received frame is already in the pool slot the merge
+// and player use; the port only demultiplexes frames to their legs.
+class XdpPort : public EventSource, public IoHandler
+{
+public:
+
+    XdpPort(const std::string& ifceName, unsigned int queue)
+    : m_ifceName{ifceName}
+    , m_queue{queue}
+    , m_flows{}
+    , m_program{}
+    , m_socket{}
+    , m_uring{nullptr}
+    , m_ioId{0}
+    {
+    }
+
+    unsigned int Queue() const
+    {
+        return m_queue;
+    }
+
+    /// @brief Routes a group and port to a leg. Must be called before Open().
+    void AddFlow(const std::string& group, unsigned short port, Receiver& leg)
+    {
+        Flow flow;
+        flow.group = inet_addr(group.c_str());
+        flow.port = htons(port);
+        flow.leg = &leg;
+        m_flows.push_back(flow);
+    }
+
+    /// @brief Attaches the XDP program, binds the socket and lends it frames.
+    void Open()
+    {
+        unsigned int ifindex = if_nametoindex(m_ifceName.c_str());
+        if (ifindex == 0)
+        {
+            fprintf(stderr, "\nInterface '%s' not found\n", m_ifceName.c_str());
+            exit(-1);
+        }
+
+        try
+        {
+            m_program.reset(new XdpProgram{ifindex, XDP_MAX_FLOWS, XDP_MAX_QUEUES});
+            m_socket.reset(new XdpSocket{ifindex, m_queue, RxPool->Data(0),
+                                         static_cast<size_t>(RxPool->Capacity()) * RxPool->SlotSize(),
+                                         XDP_FRAME_SIZE, XDP_RING_SIZE, !m_program->Generic()});
+            m_program->AddSocket(m_queue, m_socket->Fd());
+            for (const Flow& flow : m_flows)
+            {
+                m_program->AddFlow(flow.group, flow.port);
+            }
+        }
+        catch (const std::system_error& e)
+        {
+            fprintf(stderr, "AF_XDP on %s: %s\n", m_ifceName.c_str(), e.what());
+            exit(-1);
+        }
+
+        Refill();
+        printf("AF_XDP on %s queue %u, %s mode, %zu flows\n", m_ifceName.c_str(), m_queue,
+               m_program->Generic() ? "generic" : "driver", m_flows.size());
+    }
+
+    int Fd() const override
+    {
+        return m_socket->Fd();
+    }
+
+    /// @brief Takes received frames off the socket and hands each to its leg.
+    void OnReadable() override
+    {
+        uint32_t count;
+        do
+        {
+            count = m_socket->Peek(XDP_RX_BATCH);
+            uint64_t arrivalNs = MonotonicNs();
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                const struct xdp_desc& desc = m_socket->Desc(i);
+                PacketHandle handle = static_cast<PacketHandle>(desc.addr / XDP_FRAME_SIZE);
+                if (!Demux(handle, static_cast<unsigned int>(desc.addr % XDP_FRAME_SIZE), desc.len, arrivalNs))
+                {
+                    RxPool->Free(handle);
+                }
+            }
+            m_socket->Release(count);
+            Refill();
+        } while (count == XDP_RX_BATCH);
+    }
+
+    /// @brief Switches readiness notification to an io_uring poll.
+    void Attach(IoUring& uring)
+    {
+        m_uring = &uring;
+        m_ioId = uring.Register(*this);
+        ArmPollIn(uring, m_ioId, Fd());
+    }
+
+    void OnCompletion(uint32_t, int32_t, uint32_t flags) override
+    {
+        OnReadable();
+        if (!(flags & IORING_CQE_F_MORE))
+        {
+            ArmPollIn(*m_uring, m_ioId, Fd());
+        }
+    }
+
+    /// @brief Lends the kernel fresh pool slots for every frame it has used.
+    /// Also called from the event loop's ticks, so that a port starved by
+    /// an empty pool recovers without needing a packet to arrive.
+    void Refill()
+    {
+        uint32_t space = m_socket->FillSpace();
+        uint32_t filled = 0;
+        while (filled < space)
+        {
+            PacketHandle handle = RxPool->Allocate();
+            if (handle == INVALID_PACKET_HANDLE)
+            {
+                break;
+            }
+            m_socket->Fill(static_cast<uint64_t>(handle) * XDP_FRAME_SIZE);
+            ++filled;
+        }
+        if (filled)
+        {
+            m_socket->FlushFill();
+        }
+    }
+
+private:
+
+    struct Flow
+    {
+        uint32_t group;     // network byte order
+        uint16_t port;      // network byte order
+        Receiver* leg;
+    };
+
+    /// @brief Finds the leg for an Ethernet frame and delivers its payload.
+    /// @return true if a leg took the slot.
+    bool Demux(PacketHandle handle, unsigned int offset, uint32_t len, uint64_t arrivalNs)
+    {
+        const unsigned char* frame = RxPool->Data(handle) + offset;
+        const uint32_t ETH_LEN = 14;
+        if (len < ETH_LEN + 20 + 8)
+        {
+            return false;
+        }
+        const unsigned char* ip = frame + ETH_LEN;
+        uint32_t ipHeaderLen = (ip[0] & 0x0f) * 4;
+        const unsigned char* udp = ip + ipHeaderLen;
+        if (len < ETH_LEN + ipHeaderLen + 8)
+        {
+            return false;
+        }
+        uint32_t payloadLen = ((udp[4] << 8) | udp[5]) - 8;
+        if (payloadLen > len - ETH_LEN - ipHeaderLen - 8)
+        {
+            return false;
+        }
+
+        uint32_t group;
+        uint16_t port;
+        memcpy(&group, ip + 16, sizeof(group));
+        memcpy(&port, udp + 2, sizeof(port));
+        for (const Flow& flow : m_flows)
+        {
+            if (flow.group == group && flow.port == port)
+            {
+                return flow.leg->Deliver(handle, offset + ETH_LEN + ipHeaderLen + 8, payloadLen, 0, arrivalNs);
+            }
+        }
+        return false;
+    }
+
+    std::string m_ifceName;
+    unsigned int m_queue;
+    std::vector<Flow> m_flows;
+    std::unique_ptr<XdpProgram> m_program;
+    std::unique_ptr<XdpSocket> m_socket;
+    IoUring* m_uring;
+    uint32_t m_ioId;
+};
+
+//***********************************************************************************
+// Merge Engine Class
+//***********************************************************************************
+class MergeEngine
+{
+public:
+
+    MergeEngine(std::chrono::microseconds maxSkew)
+    : m_buffer{}
+    , m_maxSkewNs{static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(maxSkew).count())}
+    , m_playoutSeq{0}
+    , m_highestSeq{0}
+    , m_lastInWindowNs{0}
+    , m_started{false}
+    , m_emitted{false}
+    , m_duplicates{}
+    , m_late{}
+    , m_lost{}
+    , m_played{}
+    , m_resyncs{}
+    , m_legs{}
+    {
+    }
+
+    /// @brief Adds per-leg accounting for the next leg index.
+    void AddLeg()
+    {
+        m_legs.emplace_back(new LegStats);
+    }
+
+    /// @brief Offers a received packet to the merge. The first copy of each
+    /// sequence number wins; later copies, and packets behind the playout
+    /// point, are returned to the pool.
+    void Insert(PacketHandle handle)
+    {
+        const RtpHackPacket& pkt = RxPool->Info(handle);
+        uint16_t seqNumber = pkt.seqNumber;
+
+        if (!m_started)
+        {
+            Restart(seqNumber);
+        }
+
+        int distance = SeqDiff(m_playoutSeq, seqNumber);
+        if (distance >= MAX_DROPOUT || distance < -MAX_MISORDER)
+        {
+            // Far outside the window. Re-lock only once nothing in the window
+            // has arrived for a whole skew period, so a lagging leg cannot
+            // drag the output back. Legs are drained one after another, so a
+            // packet stamped before the last in-window one counts as late.
+            if (Elapsed(m_lastInWindowNs, pkt.arrivalNs) <= m_maxSkewNs)
+            {
+                ++m_late;
+                RxPool->Free(handle);
+                return;
+            }
+            LOG_WARNING("Sequence discontinuity, resyncing to %d", seqNumber);
+            ++m_resyncs;
+            Restart(seqNumber);
+            distance = 0;
+        }
+        m_lastInWindowNs = std::max(m_lastInWindowNs, pkt.arrivalNs);
+
+        if (distance < 0)
+        {
+            if (m_emitted)
+            {
+                // Its playout time has passed
+                ++m_late;
+                RxPool->Free(handle);
+                return;
+            }
+            // Nothing played yet; start from the earliest packet seen
+            m_playoutSeq = seqNumber;
+        }
+
+        if (!m_buffer.Emplace(seqNumber, handle))
+        {
+            if (PacketHandle* first = m_buffer.Find(seqNumber))
+            {
+                // Another leg's copy got here first. Legs are drained in
+                // turn, so that copy may carry the later kernel stamp; keep
+                // the earlier one, which sets the release time, and charge
+                // the skew to the leg that lagged.
+                const RtpHackPacket& held = RxPool->Info(*first);
+                if (pkt.arrivalNs < held.arrivalNs)
+                {
+                    m_legs[held.leg]->skew.Record(held.arrivalNs - pkt.arrivalNs);
+                    std::swap(*first, handle);
+                }
+                else
+                {
+                    m_legs[pkt.leg]->skew.Record(pkt.arrivalNs - held.arrivalNs);
+                }
+            }
+            ++m_duplicates;
+            RxPool->Free(handle);
+            return;
+        }
+        if (SeqLess(m_highestSeq, seqNumber))
+        {
+            m_highestSeq = seqNumber;
+        }
+    }
+
+    /// @brief Collects, in sequence order, the packets whose release time
+    /// (first arrival plus the maximum skew) has been reached. A packet still
+    /// missing when a later one is due is declared lost and skipped.
+    /// @param nowNs the current CLOCK_MONOTONIC time.
+    /// @param out receives the handles, now owned by the caller.
+    /// @param max the capacity of out.
+    /// @return number of handles collected.
+    unsigned int CollectDue(uint64_t nowNs, PacketHandle* out, unsigned int max)
+    {
+        unsigned int count = 0;
+        while (count < max && !m_buffer.Empty())
+        {
+            PacketHandle* head = m_buffer.Find(m_playoutSeq);
+            if (head == nullptr)
+            {
+                // Every held packet lies in (m_playoutSeq, m_highestSeq]
+                uint16_t next = m_playoutSeq;
+                do
+                {
+                    ++next;
+                } while (!m_buffer.Contains(next));
+
+                if (ReleaseNs(*m_buffer.Find(next)) > nowNs)
+                {
+                    break;
+                }
+                LOG_WARNING("Packets lost: %d to %d", m_playoutSeq, static_cast<uint16_t>(next - 1));
+                m_lost += SeqDiff(m_playoutSeq, next);
+                m_playoutSeq = next;
+                continue;
+            }
+
+            if (ReleaseNs(*head) > nowNs)
+            {
+                break;
+            }
+            RtpHackPacket& pkt = RxPool->Info(*head);
+            pkt.releaseNs = nowNs;
+            ++m_legs[pkt.leg]->first;
+            out[count++] = *head;
+            m_buffer.Release(m_playoutSeq);
+            ++m_playoutSeq;
+            ++m_played;
+            m_emitted = true;
+        }
+        return count;
+    }
+
+    std::uint64_t Duplicates() const { return m_duplicates.Value(); }
+    std::uint64_t Late() const { return m_late.Value(); }
+    std::uint64_t Lost() const { return m_lost.Value(); }
+    std::uint64_t Played() const { return m_played.Value(); }
+    std::uint64_t Resyncs() const { return m_resyncs.Value(); }
+
+    /// @brief Exports the merge counters under the given labels.
+    void RegisterMetrics(MetricsRegistry& metrics, const std::string& labels) const
+    {
+        metrics.Add("merge_duplicate_total", "Copies of packets already held", labels, m_duplicates);
+        metrics.Add("merge_late_total", "Packets arriving after their playout time", labels, m_late);
+        metrics.Add("merge_lost_total", "Sequence numbers missing from every leg", labels, m_lost);
+        metrics.Add("merge_played_total", "Packets released by the merge", labels, m_played);
+        metrics.Add("merge_resync_total", "Sequence discontinuities", labels, m_resyncs);
+    }
+
+    /// @brief Exports one leg's share of the merge under the given labels.
+    void RegisterLegMetrics(MetricsRegistry& metrics, size_t leg, const std::string& labels) const
+    {
+        metrics.Add("leg_first_total", "Packets played whose first copy came from the leg", labels, m_legs[leg]->first);
+        metrics.Add("leg_skew_seconds", "Delay of the leg's copies behind the first copy of the same packet",
+                    labels, m_legs[leg]->skew);
+    }
+
+private:
+
+    uint64_t ReleaseNs(PacketHandle handle) const
+    {
+        return RxPool->Info(handle).arrivalNs + m_maxSkewNs;
+    }
+
+    /// @brief Drops everything held and restarts the playout point at seq.
+    void Restart(uint16_t seq)
+    {
+        for (uint16_t s = m_playoutSeq; !m_buffer.Empty(); ++s)
+        {
+            if (PacketHandle* held = m_buffer.Find(s))
+            {
+                RxPool->Free(*held);
+                m_buffer.Release(s);
+            }
+        }
+        m_playoutSeq = seq;
+        m_highestSeq = seq;
+        m_started = true;
+        m_emitted = false;
+    }
+
+    JitterBuffer<PacketHandle> m_buffer;
+    uint64_t m_maxSkewNs;
+    uint16_t m_playoutSeq;
+    uint16_t m_highestSeq;
+    uint64_t m_lastInWindowNs;
+    bool m_started;
+    bool m_emitted;
+    // Written by the player's event loop thread only
+    Counter m_duplicates;
+    Counter m_late;
+    Counter m_lost;
+    Counter m_played;
+    Counter m_resyncs;
+
+    // Which leg won each packet played, and how far behind the others were
+    struct LegStats : public CacheAligned
+    {
+        Counter first;
+        LatencyHistogram skew;
+    };
+    std::vector<std::unique_ptr<LegStats>> m_legs;
+};
+
+//***********************************************************************************
+// Playout Class
+//***********************************************************************************
+struct PlayerConfig
+{
+    std::string outputIp{"239.32.32.32"};
+    unsigned short outputPort{1234};
+    std::string ifceName{DEFAULT_IFCE};
+    unsigned int rxBatch{DEFAULT_RX_BATCH};
+    RxMode rxMode{RxMode::Socket};
+    // The receive queue AF_XDP sockets bind to
+    unsigned int xdpQueue{0};
+    std::chrono::microseconds maxSkew{DEFAULT_MAX_SKEW};
+    bool useGso{false};
+    // Pace output from the RTP timestamps
+    bool pace{false};
+    std::chrono::microseconds pacingDelay{DEFAULT_PACING_DELAY};
+    // Kernel launch time clock: -1 to pace in user space, CLOCK_MONOTONIC
+    // for the fq qdisc or CLOCK_TAI for the etf qdisc
+    int txTimeClock{-1};
+};
+
+class Player : public IoHandler
+{
+public:
+
+    Player(const PlayerConfig& config = PlayerConfig{})
+    : m_legs{}
+    , m_outputIp{config.outputIp}
+    , m_outputPort{config.outputPort}
+    , m_merge{config.maxSkew}
+    , m_useGso{config.useGso}
+    , m_pace{config.pace}
+    , m_pacingDelayNs{static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(config.pacingDelay).count())}
+    , m_txTimeClock{config.txTimeClock}
+    , m_anchored{false}
+    , m_anchorNs{0}
+    , m_anchorTs{0}
+    , m_reanchors{}
+    , m_pacing{PACING_QUEUE_SLOTS}
+    , m_txHandles(TX_BATCH)
+    , m_txIovecs(TX_BATCH)
+    , m_txLaunchNs(TX_BATCH)
+    , m_txMsgs(TX_BATCH)
+    , m_txControl(TX_BATCH)
+    , m_tickNs{static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(PLAYOUT_TICK).count())}
+    , m_nextTickNs{MonotonicNs()}
+    , m_uring{nullptr}
+    , m_ioId{0}
+    , m_txRequests{}
+    , m_txFree{}
+    , m_sent{}
+    , m_txDropped{}
+    , m_endToEnd{}
+    , m_queued{}
+    , m_sending{}
+    , m_legEndToEnd{}
+    {
+        FILE *fin;
+        unsigned char pkt[188];
+        unsigned int pid_count[8192];
+        long long first_pcr27mhz = -1;
+        long first_pcrpos = -1;
+        unsigned int calc_pid = 0xffff;
+        int status;
+        struct in_addr iaddr;
+        const unsigned char ttl = 3;
+        const unsigned char one = 1;
+        long long total_sent = 0;
+        int loop_count = 0;
+        int i;
+        long filesize = 0;
+
+        const char *ifceName = config.ifceName.c_str();
+
+        memset(pid_count, 0, sizeof(pid_count));
+
+        // set content of struct saddr and imreq to zero
+        memset(&saddr, 0, sizeof(struct sockaddr_in));
+        memset(&iaddr, 0, sizeof(struct in_addr));
+
+        // open a UDP socket
+        m_sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (m_sock < 0)
+        {
+            perror("Error creating socket");
+            exit(-1);
+        }
+
+    int yes = 1;
+    status = setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+
+    if (status < 0 )
+    {
+            printf("Error setting socket options\n\n");
+            exit(1);
+    }
+
+    /* Bind to particular interface only (e.g. eth1) */
+    if ((status = setsockopt(m_sock, SOL_SOCKET, SO_BINDTODEVICE, ifceName, strlen(ifceName))) < 0)
+    {
+        perror("setsockopt() error for SO_BINDTODEVICE");
+        printf("%s\n", strerror(errno));
+        close(m_sock);
+        exit(-1);
+    }
+
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(0); // Use the first free port
+    saddr.sin_addr.s_addr = htonl(INADDR_ANY); // bind socket to any interface
+    status = bind(m_sock, (struct sockaddr *)&saddr, sizeof(struct sockaddr_in));
+
+    if ( status < 0 )
+    {
+        perror("Error binding socket to interface");
+        exit(0);
+    }
+
+    iaddr.s_addr = htonl(INADDR_ANY); // use DEFAULT interface
+
+    // Set the outgoing interface to DEFAULT
+    status =setsockopt(m_sock, IPPROTO_IP, IP_MULTICAST_IF, &iaddr, sizeof(struct in_addr));
+    if (status < 0)
+    {
+        printf("Failed to set sock opt");
+        exit(0);
+    }
+
+    // Set multicast packet TTL to 3; default TTL is 1
+    status =setsockopt(m_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(unsigned char));
+    if (status < 0)
+    {
+        printf("Failed to set sock opt");
+        exit(0);
+    }
+
+    // send multicast traffic to myself too
+    status = setsockopt(m_sock, IPPROTO_IP, IP_MULTICAST_LOOP, &one, sizeof(unsigned char));
+    if (status < 0)
+    {
+        printf("Failed to set sock opt");
+        exit(0);
+    }
+
+    // set destination multicast address
+    saddr.sin_family = AF_INET;
+    saddr.sin_addr.s_addr = inet_addr(m_outputIp.c_str());
+    saddr.sin_port = htons(m_outputPort);
+
+    // Let the kernel (fq or etf qdisc) release each packet at its launch time
+    if (m_pace && m_txTimeClock >= 0)
+    {
+        struct sock_txtime txtime;
+        memset(&txtime, 0, sizeof(txtime));
+        txtime.clockid = m_txTimeClock;
+        if (setsockopt(m_sock, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) < 0)
+        {
+            perror("setsockopt() error for SO_TXTIME, pacing in user space");
+            m_txTimeClock = -1;
+        }
+    }
+
+//    // sync byte                        8   0x47
+//    // Transport Error Indicator (TEI)  1   Set by demodulator if can't correct errors in the stream, to tell the demultiplexer that the packet has an uncorrectable error [11]
+//    // Payload Unit Start Indicator     1   1 means start of PES data or PSI otherwise zero only.
+//    // Transport Priority               1   1 means higher priority than other packets with the same PID.
+//    // PID                              13  Packet ID
+//    // Scrambling control               2   '00' = Not scrambled.   The following per DVB spec:[12]   '01' = Reserved for future use,   '10' = Scrambled with even key,   '11' = Scrambled with odd key
+//    // Adaptation field exist           2   01 = no adaptation fields, payload only, 10 = adaptation field only, 11 = adaptation field and payload
+//    // Continuity counter               4   Incremented only when a payload is present (i.e., adaptation field exist is 01 or 11)[13]
+//    // Adaptation field                 0 or more   Depends on flags
+//    // Payload Data                     0 or more   Depends on flags
+//
+//    // Adaptation Field Length                  8   Number of bytes in the adaptation field immediately following this byte
+//    // Discontinuity indicator                  1   Set to 1 if current TS packet is in a discontinuity state with respect to either the continuity counter or the program clock reference
+//    // Random Access indicator                  1   Set to 1 if the PES packet in this TS packet starts a video/audio sequence
+//    // Elementary stream priority indicator     1   1 = higher priority
+//    // PCR flag                                 1   1 means adaptation field does contain a PCR field
+//    // OPCR flag                                1   1 means adaptation field does contain an OPCR field
+//    // Splicing point flag                      1   1 means presence of splice countdown field in adaptation field
+//    // Transport private data flag              1   1 means presence of private data bytes in adaptation field
+//    // Adaptation field extension flag          1   1 means presence of adaptation field extension
+//
+//    // PCR                                      33+9    Program clock reference, stored in 6 octets in big-endian as 33 bits base, 6 bits padding, 9 bits extension.
+//    // OPCR                                     33+9    Original Program clock reference. Helps when one TS is copied into another
+//    // Splice countdown                         8   Indicates how many TS packets from this one a splicing point occurs (may be negative)
+//    // stuffing bytes                           variable
+//
+
+    }
+
+    /// @brief Adds a receiver leg to merge from. Must be called before Start().
+    void AddLeg(LegRing& ring)
+    {
+        m_legs.push_back(&ring);
+        m_legEndToEnd.emplace_back(new LatencyHistogram);
+        m_merge.AddLeg();
+    }
+
+    /// @brief Obtains the time the event loop must next call OnTimer(): the
+    /// next playout tick, or the next paced packet if that comes first.
+    uint64_t NextWakeNs()
+    {
+        uint64_t wakeNs = m_nextTickNs;
+        PacketHandle next;
+        if (m_pace && m_pacing.Peek(next))
+        {
+            wakeNs = std::min(wakeNs, RxPool->Info(next).launchNs - PacingHorizonNs());
+        }
+        return wakeNs;
+    }
+
+    /// @brief Called by the event loop once NextWakeNs() has passed. On each
+    /// playout tick, merges what the legs have delivered and emits whatever
+    /// is due.
+    void OnTimer(uint64_t nowNs)
+    {
+        if (nowNs >= m_nextTickNs)
+        {
+            m_nextTickNs += m_tickNs;
+            if (m_nextTickNs <= nowNs)
+            {
+                // Fell behind; do not try to catch up with a burst of ticks
+                m_nextTickNs = nowNs + m_tickNs;
+            }
+            DrainLegs();
+            PlayDue(nowNs);
+        }
+
+        if (m_pace)
+        {
+            SendPaced(MonotonicNs());
+        }
+    }
+
+    /// @brief Called by a spinning event loop between ticks: merges and
+    /// emits as OnTimer() does, so packets need not wait for the next tick.
+    /// @return true if the legs had delivered anything.
+    bool Poll(uint64_t nowNs)
+    {
+        bool delivered = DrainLegs() > 0;
+        PlayDue(nowNs);
+        if (m_pace)
+        {
+            SendPaced(nowNs);
+        }
+        return delivered;
+    }
+
+    /// @brief Switches output to io_uring. Each tick's messages are queued
+    /// as linked IORING_OP_SENDMSG entries that the event loop submits along
+    /// with its wait; their slots return to the pool on completion.
+    void Attach(IoUring& uring)
+    {
+        m_uring = &uring;
+        m_ioId = uring.Register(*this);
+        m_txRequests.reset(new TxRequest[TX_URING_INFLIGHT]);
+        for (unsigned int i = TX_URING_INFLIGHT; i > 0; --i)
+        {
+            m_txFree.push_back(i - 1);
+        }
+    }
+
+    /// @brief Handles the completion of a queued send.
+    void OnCompletion(uint32_t tag, int32_t result, uint32_t) override
+    {
+        TxRequest& request = m_txRequests[tag];
+        if (result < 0)
+        {
+            m_txDropped += request.count;
+            if (result != -ECANCELED)
+            {
+                LOG_ERROR("io_uring sendmsg error: %s", strerror(-result));
+                DisableGsoOn(-result);
+            }
+        }
+        else
+        {
+            m_sent += request.count;
+            uint64_t sentNs = MonotonicNs();
+            for (unsigned int i = 0; i < request.count; ++i)
+            {
+                RecordDeparture(request.handles[i], sentNs);
+            }
+        }
+        for (unsigned int i = 0; i < request.count; ++i)
+        {
+            RxPool->Free(request.handles[i]);
+        }
+        m_txFree.push_back(tag);
+    }
+
+    const std::string& OutputIp() const
+    {
+        return m_outputIp;
+    }
+
+    unsigned short OutputPort() const
+    {
+        return m_outputPort;
+    }
+
+    std::uint64_t Reanchors() const
+    {
+        return m_reanchors.Value();
+    }
+
+    /// @brief Exports the stream's counters under the given labels.
+    void RegisterMetrics(MetricsRegistry& metrics, const std::string& labels) const
+    {
+        m_merge.RegisterMetrics(metrics, labels);
+        metrics.Add("tx_packets_total", "Packets sent", labels, m_sent);
+        metrics.Add("tx_dropped_total", "Packets dropped on send", labels, m_txDropped);
+        metrics.Add("tx_reanchor_total", "Pacing clock re-anchors", labels, m_reanchors);
+        metrics.Add("latency_end_to_end_seconds", "Time from arrival of the copy played to its departure",
+                    labels, m_endToEnd);
+        metrics.Add("latency_queued_seconds", "Time from arrival to release by the merge", labels, m_queued);
+        metrics.Add("latency_send_seconds", "Time from release by the merge to departure", labels, m_sending);
+    }
+
+    /// @brief Exports the end-to-end latency of the packets played from one leg.
+    void RegisterLegMetrics(MetricsRegistry& metrics, size_t leg, const std::string& labels) const
+    {
+        metrics.Add("leg_latency_end_to_end_seconds", "Time from arrival to departure of packets played from the leg",
+                    labels, *m_legEndToEnd[leg]);
+        m_merge.RegisterLegMetrics(metrics, leg, labels);
+    }
+
+private:
+
+    /// @brief Takes every packet the merge has released. Unpaced, these are
+    /// sent straight away, a batch of up to TX_BATCH per sendmmsg(); paced,
+    /// each is given a launch time and queued.
+    void PlayDue(uint64_t nowNs)
+    {
+        unsigned int count;
+        do
+        {
+            count = m_merge.CollectDue(nowNs, m_txHandles.data(), TX_BATCH);
+            if (m_pace)
+            {
+                for (unsigned int i = 0; i < count; ++i)
+                {
+                    Schedule(m_txHandles[i], nowNs);
+                }
+                continue;
+            }
+
+            for (unsigned int i = 0; i < count; ++i)
+            {
+                const RtpHackPacket& pkt = RxPool->Info(m_txHandles[i]);
+                LOG_DEBUG("Found packet to play! %d", pkt.seqNumber);
+                m_txIovecs[i].iov_base = PacketData(m_txHandles[i]);
+                m_txIovecs[i].iov_len = pkt.length;
+                m_txLaunchNs[i] = 0;
+            }
+
+            SendBatch(count);
+        } while (count == TX_BATCH);
+    }
+
+    /// @brief Derives a packet's launch time from its RTP timestamp and
+    /// queues it for pacing.
+    void Schedule(PacketHandle handle, uint64_t nowNs)
+    {
+        RtpHackPacket& pkt = RxPool->Info(handle);
+        int64_t launchNs = 0;
+        if (m_anchored)
+        {
+            int32_t ticks = static_cast<int32_t>(pkt.rtpTimestamp - m_anchorTs);
+            launchNs = static_cast<int64_t>(m_anchorNs) + static_cast<int64_t>(ticks) * 1000000000 / RTP_CLOCK_RATE;
+        }
+        if (!m_anchored
+            || launchNs < static_cast<int64_t>(nowNs)
+            || launchNs > static_cast<int64_t>(nowNs + 2 * m_pacingDelayNs))
+        {
+            if (m_anchored)
+            {
+                ++m_reanchors;
+            }
+            m_anchored = true;
+            m_anchorTs = pkt.rtpTimestamp;
+            m_anchorNs = nowNs + m_pacingDelayNs;
+            launchNs = m_anchorNs;
+        }
+        pkt.launchNs = launchNs;
+
+        if (!m_pacing.Push(handle))
+        {
+            ++m_txDropped;
+            LOG_WARNING("Pacing queue full, dropping packet %d", pkt.seqNumber);
+            RxPool->Free(handle);
+        }
+    }
+
+    /// @brief Sends every queued packet due within the pacing horizon.
+    void SendPaced(uint64_t nowNs)
+    {
+        const uint64_t horizonNs = nowNs + PacingHorizonNs();
+        unsigned int count;
+        do
+        {
+            count = 0;
+            PacketHandle handle;
+            while (count < TX_BATCH && m_pacing.Peek(handle) && RxPool->Info(handle).launchNs <= horizonNs)
+            {
+                m_pacing.Pop(handle);
+                const RtpHackPacket& pkt = RxPool->Info(handle);
+                LOG_DEBUG("Found packet to play! %d", pkt.seqNumber);
+                m_txHandles[count] = handle;
+                m_txIovecs[count].iov_base = PacketData(handle);
+                m_txIovecs[count].iov_len = pkt.length;
+                m_txLaunchNs[count] = pkt.launchNs;
+                ++count;
+            }
+
+            SendBatch(count);
+        } while (count == TX_BATCH);
+    }
+
+    uint64_t PacingHorizonNs() const
+    {
+        return m_txTimeClock >= 0 ? TXTIME_LOOKAHEAD_NS : PACING_SLACK_NS;
+    }
+
+    /// @brief Offers every handle the receivers have published to the merge.
+    /// @return the number of handles taken.
+    unsigned int DrainLegs()
+    {
+        unsigned int count = 0;
+        PacketHandle handle;
+        for (size_t leg = 0; leg < m_legs.size(); ++leg)
+        {
+            while (m_legs[leg]->Pop(handle))
+            {
+                RxPool->Info(handle).leg = static_cast<uint16_t>(leg);
+                m_merge.Insert(handle);
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    /// @brief Records the latencies of a packet that has just been sent.
+    /// With SO_TXTIME the kernel holds it until its launch time, which is
+    /// then taken as its departure.
+    void RecordDeparture(PacketHandle handle, uint64_t sentNs)
+    {
+        const RtpHackPacket& pkt = RxPool->Info(handle);
+        uint64_t departureNs = (m_pace && m_txTimeClock >= 0) ? std::max(sentNs, pkt.launchNs) : sentNs;
+        uint64_t endToEndNs = Elapsed(pkt.arrivalNs, departureNs);
+        m_endToEnd.Record(endToEndNs);
+        m_queued.Record(Elapsed(pkt.arrivalNs, pkt.releaseNs));
+        m_sending.Record(Elapsed(pkt.releaseNs, departureNs));
+        m_legEndToEnd[pkt.leg]->Record(endToEndNs);
+    }
+
+
+    /// @brief Sends the first count entries of m_txIovecs with one sendmmsg()
+    /// call, or queues them on the io_uring, and gives their slots (from
+    /// m_txHandles) back to the pool once sent. With GSO enabled, each run of
+    /// same-size packets sharing a launch time goes out as a single
+    /// UDP_SEGMENT message. With SO_TXTIME, each message carries its launch
+    /// time from m_txLaunchNs.
+    void SendBatch(unsigned int count)
+    {
+        const bool txTime = m_pace && m_txTimeClock >= 0;
+        int64_t clockOffsetNs = 0;
+        if (txTime && m_txTimeClock != CLOCK_MONOTONIC)
+        {
+            struct timespec ts;
+            clock_gettime(m_txTimeClock, &ts);
+            clockOffsetNs = static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec
+                          - static_cast<int64_t>(MonotonicNs());
+        }
+
+        unsigned int msgCount = 0;
+        unsigned int i = 0;
+        while (i < count)
+        {
+            size_t segSize = m_txIovecs[i].iov_len;
+            unsigned int segs = 1;
+            if (m_useGso)
+            {
+                while (i + segs < count
+                       && segs < GSO_MAX_SEGMENTS
+                       && m_txIovecs[i + segs].iov_len == segSize
+                       && m_txLaunchNs[i + segs] == m_txLaunchNs[i]
+                       && (segs + 1) * segSize <= GSO_MAX_BYTES)
+                {
+                    ++segs;
+                }
+            }
+
+            struct msghdr& hdr = m_txMsgs[msgCount].msg_hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.msg_name = &saddr;
+            hdr.msg_namelen = sizeof(struct sockaddr_in);
+            hdr.msg_iov = &m_txIovecs[i];
+            hdr.msg_iovlen = segs;
+            if (segs > 1 || txTime)
+            {
+                hdr.msg_control = m_txControl[msgCount].buf;
+                hdr.msg_controllen = sizeof(m_txControl[msgCount].buf);
+                size_t controlLen = 0;
+                struct cmsghdr* cm = CMSG_FIRSTHDR(&hdr);
+                if (segs > 1)
+                {
+                    cm->cmsg_level = SOL_UDP;
+                    cm->cmsg_type = UDP_SEGMENT;
+                    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                    *reinterpret_cast<uint16_t*>(CMSG_DATA(cm)) = static_cast<uint16_t>(segSize);
+                    controlLen += CMSG_SPACE(sizeof(uint16_t));
+                    cm = CMSG_NXTHDR(&hdr, cm);
+                }
+                if (txTime)
+                {
+                    cm->cmsg_level = SOL_SOCKET;
+                    cm->cmsg_type = SCM_TXTIME;
+                    cm->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+                    uint64_t launchNs = m_txLaunchNs[i] + clockOffsetNs;
+                    memcpy(CMSG_DATA(cm), &launchNs, sizeof(launchNs));
+                    controlLen += CMSG_SPACE(sizeof(uint64_t));
+                }
+                hdr.msg_controllen = controlLen;
+            }
+            ++msgCount;
+            i += segs;
+        }
+
+        unsigned int sent = 0;
+        unsigned int queuedPackets = 0;
+        if (m_uring)
+        {
+            sent = QueueSends(msgCount, queuedPackets);
+        }
+        const unsigned int queued = sent;
+        while (sent < msgCount)
+        {
+            int status = sendmmsg(m_sock, &m_txMsgs[sent], msgCount - sent, 0);
+            if (status < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                LOG_ERROR("sendmmsg() error: %s", strerror(errno));
+                DisableGsoOn(errno);
+                break;
+            }
+            sent += status;
+        }
+
+        unsigned int sentPackets = 0;
+        for (unsigned int m = queued; m < sent; ++m)
+        {
+            sentPackets += m_txMsgs[m].msg_hdr.msg_iovlen;
+        }
+        m_sent += sentPackets;
+        m_txDropped += count - queuedPackets - sentPackets;
+        uint64_t sentNs = MonotonicNs();
+        for (unsigned int i = queuedPackets; i < queuedPackets + sentPackets; ++i)
+        {
+            RecordDeparture(m_txHandles[i], sentNs);
+        }
+
+        // Slots of messages that went to the io_uring are freed on completion
+        for (unsigned int i = queuedPackets; i < count; ++i)
+        {
+            RxPool->Free(m_txHandles[i]);
+        }
+    }
+
+    /// @brief Moves the first msgCount messages built by SendBatch() into
+    /// in-flight requests and queues them as one linked chain, so that they
+    /// leave in order even if the kernel has to retry one.
+    /// @param packets set to the number of packets in the queued messages.
+    /// @return the number of messages queued; the rest are sent directly.
+    unsigned int QueueSends(unsigned int msgCount, unsigned int& packets)
+    {
+        unsigned int queued = 0;
+        struct io_uring_sqe* previous = nullptr;
+        while (queued < msgCount && !m_txFree.empty())
+        {
+            uint32_t tag = m_txFree.back();
+            struct io_uring_sqe* sqe = m_uring->GetSqe(m_ioId, tag);
+            if (sqe == nullptr)
+            {
+                break;
+            }
+            m_txFree.pop_back();
+
+            const struct msghdr& hdr = m_txMsgs[queued].msg_hdr;
+            TxRequest& request = m_txRequests[tag];
+            request.count = hdr.msg_iovlen;
+            for (unsigned int i = 0; i < request.count; ++i)
+            {
+                request.iov[i] = hdr.msg_iov[i];
+                request.handles[i] = m_txHandles[packets + i];
+            }
+            packets += request.count;
+            request.hdr = hdr;
+            request.hdr.msg_iov = request.iov;
+            if (hdr.msg_controllen)
+            {
+                memcpy(request.control.buf, hdr.msg_control, hdr.msg_controllen);
+                request.hdr.msg_control = request.control.buf;
+            }
+
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = m_sock;
+            sqe->addr = reinterpret_cast<uint64_t>(&request.hdr);
+            sqe->len = 1;
+            if (previous)
+            {
+                previous->flags |= IOSQE_IO_LINK;
+            }
+            previous = sqe;
+            ++queued;
+        }
+        return queued;
+    }
+
+    void DisableGsoOn(int error)
+    {
+        if (m_useGso && (error == EIO || error == EINVAL || error == ENOPROTOOPT))
+        {
+            LOG_WARNING("Disabling UDP GSO");
+            m_useGso = false;
+        }
+    }
+
+    // Room for a UDP_SEGMENT and an SCM_TXTIME control message
+    union TxControl
+    {
+        char buf[CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t))];
+        struct cmsghdr align;
+    };
+
+    std::vector<LegRing*> m_legs;
+    std::string m_outputIp;
+    unsigned short m_outputPort;
+    MergeEngine m_merge;
+    int m_sock;
+    struct sockaddr_in saddr;
+    struct ip_mreq imreq;
+    socklen_t socklen;
+    bool m_useGso;
+    bool m_pace;
+    uint64_t m_pacingDelayNs;
+    int m_txTimeClock;
+    bool m_anchored;
+    uint64_t m_anchorNs;
+    uint32_t m_anchorTs;
+    Counter m_reanchors;
+    SpscRing<PacketHandle> m_pacing;
+    std::vector<PacketHandle> m_txHandles;
+    std::vector<struct iovec> m_txIovecs;
+    std::vector<uint64_t> m_txLaunchNs;
+    std::vector<struct mmsghdr> m_txMsgs;
+    std::vector<TxControl> m_txControl;
+    uint64_t m_tickNs;
+    uint64_t m_nextTickNs;
+
+    // A message queued on the io_uring, kept until its completion
+    struct TxRequest
+    {
+        struct msghdr hdr;
+        struct iovec iov[GSO_MAX_SEGMENTS];
+        PacketHandle handles[GSO_MAX_SEGMENTS];
+        unsigned int count;
+        TxControl control;
+    };
+
+    IoUring* m_uring;
+    uint32_t m_ioId;
+    std::unique_ptr<TxRequest[]> m_txRequests;
+    std::vector<uint32_t> m_txFree;
+    // Written by the player's event loop thread only
+    Counter m_sent;
+    Counter m_txDropped;
+    // Latencies of the packets sent, for the stream and by winning leg
+    LatencyHistogram m_endToEnd;
+    LatencyHistogram m_queued;
+    LatencyHistogram m_sending;
+    std::vector<std::unique_ptr<LatencyHistogram>> m_legEndToEnd;
+};
+
+
+//***********************************************************************************
+// Session Class
+//***********************************************************************************
+struct LegConfig
+{
+    std::string group;
+    unsigned short port;
+    std::string ifceName;
+};
+
+struct SessionConfig
+{
+    PlayerConfig output;
+    std::vector<LegConfig> legs;
+};
+
+// One merged stream: its receiver legs, the rings joining them to the merge,
+// and the player
+class Session : public CacheAligned
+{
+public:
+
+    Session(const SessionConfig& config, unsigned int& legNumber)
+    : m_rings{}
+    , m_player{config.output}
+    , m_receivers{}
+    , m_config{config}
+    , m_firstLeg{legNumber + 1}
+    {
+        for (const LegConfig& leg : config.legs)
+        {
+            m_rings.emplace_back(new LegRing{LEG_RING_SLOTS});
+            m_player.AddLeg(*m_rings.back());
+
+            printf("\nCreating Receiver %u\n", ++legNumber);
+            m_receivers.emplace_back(new Receiver{leg.group.c_str(), leg.port, leg.ifceName.c_str(),
+                                                  *m_rings.back(), config.output.rxBatch, config.output.rxMode});
+        }
+    }
+
+    Player& Output()
+    {
+        return m_player;
+    }
+
+    std::vector<std::unique_ptr<Receiver>>& Legs()
+    {
+        return m_receivers;
+    }
+
+    const SessionConfig& Config() const
+    {
+        return m_config;
+    }
+
+    /// @brief Exports the stream's and every leg's counters and latencies.
+    void RegisterMetrics(MetricsRegistry& metrics, unsigned int sessionNumber) const
+    {
+        std::string session = "session=\"" + std::to_string(sessionNumber) + "\"";
+        m_player.RegisterMetrics(metrics, session + ",output=\"" + m_config.output.outputIp + ":"
+                                          + std::to_string(m_config.output.outputPort) + "\"");
+        for (size_t i = 0; i < m_receivers.size(); ++i)
+        {
+            const LegConfig& leg = m_config.legs[i];
+            std::string labels = session + ",leg=\"" + std::to_string(m_firstLeg + i) + "\",source=\""
+                               + leg.group + ":" + std::to_string(leg.port) + "@" + leg.ifceName + "\"";
+            m_receivers[i]->RegisterMetrics(metrics, labels);
+            m_player.RegisterLegMetrics(metrics, i, labels);
+        }
+    }
+
+private:
+
+    std::vector<std::unique_ptr<LegRing>> m_rings;
+    Player m_player;
+    std::vector<std::unique_ptr<Receiver>> m_receivers;
+    SessionConfig m_config;
+    unsigned int m_firstLeg;
+};
+
+//***********************************************************************************
+// Event Loop Class
+//***********************************************************************************
+// One I/O thread. It waits in epoll for any of its receiver sockets to become
+// readable, and on a timerfd armed for the earliest wake-up of its players.
+// With io_uring it instead waits for completions, with a timeout at that
+// wake-up, and its players' sends go out with the next wait. The thread can
+// be pinned to one CPU and run SCHED_FIFO.
+//
+// With a spin budget the loop polls instead of blocking (epoll_wait with no
+// timeout, or a non-waiting io_uring_enter) and has its players merge
+// whatever the leg rings hold on every pass rather than once per tick. Once
+// a whole budget passes with no packets it parks as above, and spins again
+// after the next wake-up.
+class EventLoop : public IoHandler
+{
+public:
+
+    /// @param cpu the CPU to pin the thread to, or -1 to let it float.
+    /// @param fifoPriority the SCHED_FIFO priority, or 0 for SCHED_OTHER.
+    /// @param spinUs how long to spin idle before parking, or 0 to block.
+    EventLoop(bool useUring = false, int cpu = -1, int fifoPriority = 0, unsigned int spinUs = 0)
+    : m_thread{}
+    , m_cpu{cpu}
+    , m_fifoPriority{fifoPriority}
+    , m_spinNs{spinUs * 1000ull}
+    , m_epfd{-1}
+    , m_timerfd{-1}
+    , m_armedNs{0}
+    , m_players{}
+    , m_receivers{}
+    , m_xdpPorts{}
+    , m_uring{}
+    , m_sharedBuffers{false}
+    , m_epollId{0}
+    , m_epollWatched{0}
+    {
+        if (useUring)
+        {
+            try
+            {
+                m_uring.reset(new IoUring{URING_ENTRIES});
+                m_epollId = m_uring->Register(*this);
+                m_sharedBuffers = IoBufferRing::Probe();
+                printf("io_uring receive buffers: %s\n", m_sharedBuffers ? "provided buffer rings" : "per-buffer provide");
+            }
+            catch (const std::system_error& e)
+            {
+                printf("io_uring unavailable (%s), using epoll\n", e.what());
+                m_uring.reset();
+            }
+        }
+        // With io_uring, the epoll set only holds legs that fell back from it
+        m_epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (m_epfd < 0)
+        {
+            perror("Error creating event loop");
+            exit(-1);
+        }
+        if (m_uring)
+        {
+            return;
+        }
+
+        m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (m_timerfd < 0)
+        {
+            perror("Error creating event loop");
+            exit(-1);
+        }
+        Watch(m_timerfd, nullptr);
+    }
+
+    /// @brief Services a receiver's socket. Must be called before Start().
+    void AddReceiver(Receiver& receiver)
+    {
+        if (m_spinNs)
+        {
+            EnableBusyPoll(receiver.Fd(), SOCKET_BUSY_POLL_US);
+        }
+        if (m_uring)
+        {
+            receiver.Attach(*m_uring, m_sharedBuffers, [this](EventSource& source) { WatchFromUring(source); });
+            m_receivers.push_back(&receiver);
+        }
+        else
+        {
+            Watch(receiver.Fd(), &receiver);
+        }
+    }
+
+    /// @brief Services an AF_XDP port. Must be called before Start().
+    void AddXdpPort(XdpPort& port)
+    {
+        if (m_spinNs)
+        {
+            EnableBusyPoll(port.Fd(), SOCKET_BUSY_POLL_US);
+        }
+        if (m_uring)
+        {
+            port.Attach(*m_uring);
+        }
+        else
+        {
+            Watch(port.Fd(), &port);
+        }
+        m_xdpPorts.push_back(&port);
+    }
+
+    /// @brief Drives a player's ticks. Must be called before Start().
+    void AddPlayer(Player& player)
+    {
+        if (m_uring)
+        {
+            player.Attach(*m_uring);
+        }
+        m_players.push_back(&player);
+    }
+
+    void Start()
+    {
+        m_thread = std::thread{&EventLoop::Execute, this};
+    }
+
+    /// @brief Obtains the NUMA node of the loop's CPU, or -1 if unpinned.
+    int NumaNode() const
+    {
+        return m_cpu >= 0 ? CpuNumaNode(m_cpu) : -1;
+    }
+
+    void Execute()
+    {
+        printf("\nStarting Event Loop Thread (%s, %s)\n", m_uring ? "io_uring" : "epoll",
+               m_spinNs ? "spinning" : "blocking");
+        try
+        {
+            if (m_cpu >= 0)
+            {
+                PinCurrentThread(m_cpu);
+                printf("Event loop pinned to CPU %d\n", m_cpu);
+            }
+            if (m_fifoPriority > 0)
+            {
+                SetRealtimePriority(m_fifoPriority);
+            }
+        }
+        catch (const std::system_error& e)
+        {
+            printf("Event loop placement failed, continuing: %s\n", e.what());
+        }
+
+        if (m_uring)
+        {
+            ExecuteUring();
+        }
+
+        struct epoll_event events[MAX_EPOLL_EVENTS];
+        uint64_t parkNs = MonotonicNs() + m_spinNs;
+        while (true)
+        {
+            bool spinning = MonotonicNs() < parkNs;
+            if (!spinning)
+            {
+                ArmTimer();
+            }
+
+            int count = epoll_wait(m_epfd, events, MAX_EPOLL_EVENTS, spinning ? 0 : -1);
+            if (count < 0)
+            {
+                if (errno != EINTR)
+                {
+                    LOG_ERROR("epoll_wait: %s", strerror(errno));
+                }
+                continue;
+            }
+
+            for (int i = 0; i < count; ++i)
+            {
+                EventSource* source = static_cast<EventSource*>(events[i].data.ptr);
+                if (source == nullptr)
+                {
+                    uint64_t expirations;
+                    if (read(m_timerfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+                    {
+                        LOG_ERROR("timerfd read: %s", strerror(errno));
+                    }
+                    m_armedNs = 0;
+                }
+                else
+                {
+                    source->OnReadable();
+                }
+            }
+
+            bool busy = RunPlayers(spinning) || count > 0;
+            if (busy || !spinning)
+            {
+                parkNs = MonotonicNs() + m_spinNs;
+            }
+        }
+    }
+
+    /// @brief Services the legs that fell back from io_uring to epoll: the
+    /// ring reports the epoll set readable, and each ready leg is read.
+    void OnCompletion(uint32_t, int32_t, uint32_t) override
+    {
+        struct epoll_event events[MAX_EPOLL_EVENTS];
+        int count = epoll_wait(m_epfd, events, MAX_EPOLL_EVENTS, 0);
+        for (int i = 0; i < count; ++i)
+        {
+            static_cast<EventSource*>(events[i].data.ptr)->OnReadable();
+        }
+        if (count < 0 && errno != EINTR)
+        {
+            LOG_ERROR("epoll_wait: %s", strerror(errno));
+        }
+        ArmPollIn(*m_uring, m_epollId, m_epfd, false);
+    }
+
+private:
+
+    /// @brief Moves a leg the io_uring cannot receive for onto the epoll
+    /// set, which the ring then polls alongside everything else.
+    void WatchFromUring(EventSource& source)
+    {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = &source;
+        if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, source.Fd(), &event) < 0)
+        {
+            LOG_ERROR("epoll_ctl: %s, leg stopped", strerror(errno));
+            return;
+        }
+        if (m_epollWatched++ == 0)
+        {
+            ArmPollIn(*m_uring, m_epollId, m_epfd, false);
+        }
+    }
 
-                    int status = sendto(m_sock, it->m_data, RTP_PACKET_SIZE, 0, (struct sockaddr *)&saddr, socklen);
-                    if (status < 0)
-                    {
-                        perror("sendto() error");
-                        printf("%s\n", strerror(errno));
-                    }
+    void Watch(int fd, EventSource* source)
+    {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = source;
+        if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &event) < 0)
+        {
+            perror("epoll_ctl");
+            exit(-1);
+        }
+    }
 
-                    RxSet.erase(it);
-                    play = false;
-                    seqPlay.seqNumber = (seqPlay.seqNumber + 1) % 0xffff;
-                    m_condVariable.notify_all();
-                }
-                else
-                {
-                    printf("\nPacket not found: %d\n", seqPlay.seqNumber);
-                    retries++;
-                    if (retries == 500)
-                    {
-                        printf("\nToo many retries");
-                        // Set packet to min present in the buffer
-//                        seqPlay.seqNumber = std::min_element(RxSet.begin(), RxSet.end())->seqNumber;
-//                        seqPlay.seqNumber++;
-                        setFirstPacket = true;
-                        retries = 0;
-//                        seqPlay.seqNumber = (seqPlay.seqNumber + 1) % 0xffff;
-                    }
+    /// @brief The io_uring loop: one system call both submits everything
+    /// queued since the last one (sends and re-armed receives) and waits.
+    void ExecuteUring()
+    {
+        uint64_t parkNs = MonotonicNs() + m_spinNs;
+        while (true)
+        {
+            uint64_t nowNs = MonotonicNs();
+            bool spinning = nowNs < parkNs;
+            int status;
+            if (spinning)
+            {
+                status = m_uring->Poll();
+            }
+            else
+            {
+                uint64_t wakeNs = EarliestWakeNs();
+                status = m_uring->Wait(wakeNs > nowNs ? wakeNs - nowNs : 0);
+            }
+            if (status < 0 && status != -ETIME && status != -EINTR && status != -EBUSY)
+            {
+                LOG_ERROR("io_uring_enter: %s", strerror(-status));
+            }
+            unsigned int count = m_uring->Dispatch();
+            bool busy = RunPlayers(spinning) || count > 0;
+            if (busy || !spinning)
+            {
+                parkNs = MonotonicNs() + m_spinNs;
+            }
+        }
+    }
 
-                        play = false;
-                        m_condVariable.notify_all();
-                }
+    /// @brief Calls every player whose wake-up time has passed, and while
+    /// spinning polls the others, then lends the slots they freed to the
+    /// io_uring legs and the AF_XDP fill rings.
+    /// @return true if a polled player found packets from its legs.
+    bool RunPlayers(bool spinning)
+    {
+        bool busy = false;
+        uint64_t nowNs = MonotonicNs();
+        for (Player* player : m_players)
+        {
+            if (player->NextWakeNs() <= nowNs)
+            {
+                player->OnTimer(nowNs);
+            }
+            else if (spinning)
+            {
+                busy = player->Poll(nowNs) || busy;
             }
         }
-//        if ((loop_count == 0) && (! do_calc_rate))
-//        {
-//            printf("Starting to transmit on rtp://%s:%u\n", multicast_ip, multicast_port);
-//            clock_gettime(CLOCK_MONOTONIC, &start_time);
-//        }
-//
-//        if (fseek(fin, 0, SEEK_SET)) // seek back to beginning of file
-//        {
-//            perror("fseek");
-//            exit(-1);
-//        }
-//
-//        while (!feof(fin))
-//        {
-//            int ch = fgetc(fin);
-//            if (ch < 0)
-//            {
-//                // EOF
-//                break;
-//            }
-//
-//            if (ch != 0x47)
-//            {
-//                unsigned int pos = ftell(fin) - 1;
-//                unsigned int pos2;
-//
-//                printf("WARNING: TS Sync Byte incorrect. Expected 0x47. Got 0x%02x (at %u)\n", (pkt[0]&0xff), pos);
-//
-//                while (ch >= 0 && ch != 0x47)
-//                {
-//                    ch = fgetc(fin);
-//                }
-//                pos2 = ftell(fin) - 1;    // Position of sync byte
-//                printf("Skipped %u bytes\n", pos2 - pos);
-//
-//                if (ch < 0)
-//                {
-//                    // EOF
-//                    break;
-//                }
-//                pos = pos2;
-//            }
-//
-//            pkt[0] = ch;
-//            if (fread(pkt+1, 1, 187, fin) != 187)
-//            {
-//                printf("EOF\n");
-//                continue;
-//            }
-//
-//            unsigned int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
-//
-//            pid_count[pid]++;
-//
-//            if (send_packet(sock, pkt, (struct sockaddr *)&saddr, socklen))
-//            {
-//                rate_limit(total_sent + fpos);
-//            }
-//        }
-//    }
+        for (Receiver* receiver : m_receivers)
+        {
+            receiver->Refill();
+        }
+        for (XdpPort* port : m_xdpPorts)
+        {
+            port->Refill();
+        }
+        return busy;
     }
 
-private:
+    uint64_t EarliestWakeNs() const
+    {
+        uint64_t wakeNs = UINT64_MAX;
+        for (Player* player : m_players)
+        {
+            wakeNs = std::min(wakeNs, player->NextWakeNs());
+        }
+        return wakeNs;
+    }
+
+    /// @brief Arms the timerfd for the earliest player wake-up, unless it is
+    /// already armed for that time.
+    void ArmTimer()
+    {
+        if (m_players.empty())
+        {
+            return;
+        }
+        uint64_t wakeNs = EarliestWakeNs();
+        if (wakeNs == m_armedNs)
+        {
+            return;
+        }
+
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        // A zero it_value would disarm the timer
+        wakeNs = std::max<uint64_t>(wakeNs, 1);
+        spec.it_value.tv_sec = wakeNs / 1000000000ull;
+        spec.it_value.tv_nsec = wakeNs % 1000000000ull;
+        if (timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
+        {
+            LOG_ERROR("timerfd_settime: %s", strerror(errno));
+        }
+        m_armedNs = wakeNs;
+    }
 
     std::thread m_thread;
-    int m_sock;
-    struct sockaddr_in saddr;
-    struct ip_mreq imreq;
-    socklen_t socklen;
+    int m_cpu;
+    int m_fifoPriority;
+    uint64_t m_spinNs;
+    int m_epfd;
+    int m_timerfd;
+    uint64_t m_armedNs;
+    std::vector<Player*> m_players;
+    std::vector<Receiver*> m_receivers;
+    std::vector<XdpPort*> m_xdpPorts;
+    std::unique_ptr<IoUring> m_uring;
+    bool m_sharedBuffers;
+    // io_uring mode: the handler id of the poll on m_epfd, and how many
+    // legs fell back to it
+    uint32_t m_epollId;
+    unsigned int m_epollWatched;
+};
+
+//***********************************************************************************
+// Command Line
+//***********************************************************************************
+static void Usage(const char* prog)
+{
+    fprintf(stderr,
+"Usage: %s [options] [group:port[@ifce] ...] [-S [options] group:port[@ifce] ...] ...\n\n"
+"Merges any number of redundant RTP multicast legs into one output. Each -S\n"
+"starts another merged stream (session) with its own output and legs; the\n"
+"options before the first -S are the defaults for every session, and any legs\n"
+"given there form a session of their own. With no legs at all, listens on\n"
+"%s and %s.\n\n"
+"Process options:\n"
+"  -n count        event loop threads servicing all sessions (%u)\n"
+"  -u              use io_uring for receive and send, falling back to\n"
+"                  epoll and socket calls if the kernel lacks it\n"
+"  -c cpus         pin event loop threads to these CPUs in turn, e.g. 2,4-7;\n"
+"                  each loop's sessions are allocated on its CPU's NUMA node\n"
+"  -P prio         run event loop threads SCHED_FIFO at priority 1-99\n"
+"  -B usec         spin, busy polling sockets (SO_BUSY_POLL) and leg rings,\n"
+"                  for usec of idle time before blocking (%u: always block)\n"
+"  -f file         read further arguments from file, one or more per line,\n"
+"                  '#' starts a comment\n"
+"  -l level        log level: debug, info, warning or error (info);\n"
+"                  debug also traces packets played\n"
+"  -m file         write Prometheus text metrics to file every second\n"
+"  -M port         serve Prometheus metrics on http://127.0.0.1:port/\n"
+"  -h              show this help\n\n"
+"Session options:\n"
+"  -i ifce         default interface for legs and output (%s)\n"
+"  -o group:port   output address (%s)\n"
+"  -s usec         maximum inter-leg skew, at least 1 (%lld)\n"
+"  -b count        datagrams per receive batch (%u)\n"
+"  -r              read legs from a TPACKET_V3 capture ring on the\n"
+"                  interface (needs CAP_NET_RAW)\n"
+"  -x queue        read legs from an AF_XDP socket on receive queue\n"
+"                  'queue' of the interface; one queue per interface\n"
+"  -g              send with UDP GSO\n"
+"  -p              pace output from RTP timestamps\n"
+"  -d usec         pacing delay (%lld)\n"
+"  -T mono|tai     hand launch times to the kernel with SO_TXTIME\n",
+            prog, DEFAULT_LEGS[0], DEFAULT_LEGS[1], DEFAULT_IO_THREADS, DEFAULT_SPIN_US, DEFAULT_IFCE, DEFAULT_OUTPUT,
+            static_cast<long long>(DEFAULT_MAX_SKEW.count()), DEFAULT_RX_BATCH,
+            static_cast<long long>(DEFAULT_PACING_DELAY.count()));
+}
+
+/// @brief Parses the decimal value of option arg, which must lie in
+/// [min, max]; anything else is reported.
+static bool ParseNumber(const std::string& arg, const std::string& value, unsigned long min, unsigned long max,
+                        unsigned long& number)
+{
+    errno = 0;
+    number = strtoul(value.c_str(), nullptr, 10);
+    if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos || errno == ERANGE
+        || number < min || number > max)
+    {
+        fprintf(stderr, "Option %s needs a number from %lu to %lu, not '%s'\n", arg.c_str(), min, max, value.c_str());
+        return false;
+    }
+    return true;
+}
+
+/// @brief Parses "group:port[@ifce]".
+static bool ParseAddress(const std::string& text, std::string& group, unsigned short& port, std::string& ifceName)
+{
+    std::string::size_type colon = text.find(':');
+    if (colon == std::string::npos || colon == 0)
+    {
+        return false;
+    }
+    std::string::size_type at = text.find('@', colon);
+    group = text.substr(0, colon);
+    char* end = nullptr;
+    std::string portText = text.substr(colon + 1, at == std::string::npos ? std::string::npos : at - colon - 1);
+    unsigned long value = strtoul(portText.c_str(), &end, 10);
+    if (portText.empty() || *end != '\0' || value == 0 || value > 65535)
+    {
+        return false;
+    }
+    port = static_cast<unsigned short>(value);
+    if (at != std::string::npos)
+    {
+        ifceName = text.substr(at + 1);
+    }
+    struct in_addr addr;
+    return inet_aton(group.c_str(), &addr) != 0 && !ifceName.empty();
+}
+
+/// @brief Appends the whitespace separated words of a config file to args.
+static bool ReadConfigFile(const char* path, std::vector<std::string>& args)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        fprintf(stderr, "Cannot open config file '%s'\n", path);
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream words(line.substr(0, line.find('#')));
+        std::string word;
+        while (words >> word)
+        {
+            args.push_back(word);
+        }
+    }
+    return true;
+}
+
+// Options shared by every session in the process
+struct ProcessConfig
+{
+    unsigned int ioThreads{DEFAULT_IO_THREADS};
+    bool useUring{false};
+    // Prometheus export: a file rewritten every METRICS_PERIOD, and/or a
+    // loopback HTTP port (0 for none)
+    std::string metricsFile;
+    unsigned short metricsPort{0};
+    LogLevel logLevel{LogLevel::Info};
+    // CPUs the event loops are pinned to, round-robin (none to float), and
+    // their SCHED_FIFO priority (0 for SCHED_OTHER)
+    std::vector<unsigned int> cpus;
+    int fifoPriority{0};
+    // Idle time an event loop spins for before parking (0 to always block)
+    unsigned int spinUs{DEFAULT_SPIN_US};
+};
+
+// A session as given on the command line, before its addresses are parsed
+struct SessionArgs
+{
+    PlayerConfig config;
+    std::string output{DEFAULT_OUTPUT};
+    std::vector<std::string> legSpecs;
 };
 
+static bool BuildSession(const SessionArgs& args, SessionConfig& session)
+{
+    session.output = args.config;
+    for (const std::string& spec : args.legSpecs)
+    {
+        LegConfig leg;
+        leg.ifceName = args.config.ifceName;
+        if (!ParseAddress(spec, leg.group, leg.port, leg.ifceName))
+        {
+            fprintf(stderr, "Bad leg address '%s'\n", spec.c_str());
+            return false;
+        }
+        session.legs.push_back(leg);
+    }
+
+    if (!ParseAddress(args.output, session.output.outputIp, session.output.outputPort, session.output.ifceName))
+    {
+        fprintf(stderr, "Bad output address '%s'\n", args.output.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool ParseArgs(int argc, char** argv, std::vector<SessionConfig>& sessions, ProcessConfig& process)
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    SessionArgs defaults;
+    std::vector<SessionArgs> explicitSessions;
+    SessionArgs* current = &defaults;
+
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        const std::string arg = args[i];
+        if (arg.size() != 2 || arg[0] != '-')
+        {
+            current->legSpecs.push_back(arg);
+            continue;
+        }
+        if (arg == "-h")
+        {
+            return false;
+        }
+        if (arg == "-S")
+        {
+            explicitSessions.push_back(defaults);
+            explicitSessions.back().legSpecs.clear();
+            current = &explicitSessions.back();
+            continue;
+        }
+        if (arg == "-g")
+        {
+            current->config.useGso = true;
+            continue;
+        }
+        if (arg == "-p")
+        {
+            current->config.pace = true;
+            continue;
+        }
+        if (arg == "-r")
+        {
+            current->config.rxMode = RxMode::PacketRing;
+            continue;
+        }
+        if (arg == "-u")
+        {
+            process.useUring = true;
+            continue;
+        }
+        if (i + 1 == args.size())
+        {
+            fprintf(stderr, "Option %s needs a value\n", arg.c_str());
+            return false;
+        }
+        const std::string value = args[++i];
+        unsigned long number = 0;
+        if (arg == "-n")
+        {
+            if (!ParseNumber(arg, value, 1, MAX_IO_THREADS, number))
+            {
+                return false;
+            }
+            process.ioThreads = static_cast<unsigned int>(number);
+        }
+        else if (arg == "-c")
+        {
+            process.cpus.clear();
+            if (!ParseCpuList(value, process.cpus))
+            {
+                fprintf(stderr, "Bad CPU list '%s'\n", value.c_str());
+                return false;
+            }
+        }
+        else if (arg == "-P")
+        {
+            if (!ParseNumber(arg, value, 1, 99, number))
+            {
+                return false;
+            }
+            process.fifoPriority = static_cast<int>(number);
+        }
+        else if (arg == "-B")
+        {
+            if (!ParseNumber(arg, value, 0, MAX_OPTION_USEC, number))
+            {
+                return false;
+            }
+            process.spinUs = static_cast<unsigned int>(number);
+        }
+        else if (arg == "-l")
+        {
+            static const char* LEVELS[] = {"debug", "info", "warning", "error"};
+            auto level = std::find(std::begin(LEVELS), std::end(LEVELS), value);
+            if (level == std::end(LEVELS))
+            {
+                fprintf(stderr, "Unknown log level '%s'\n", value.c_str());
+                return false;
+            }
+            process.logLevel = static_cast<LogLevel>(level - std::begin(LEVELS));
+        }
+        else if (arg == "-m")
+        {
+            process.metricsFile = value;
+        }
+        else if (arg == "-M")
+        {
+            if (!ParseNumber(arg, value, 0, 65535, number))
+            {
+                return false;
+            }
+            process.metricsPort = static_cast<unsigned short>(number);
+        }
+        else if (arg == "-i")
+        {
+            current->config.ifceName = value;
+        }
+        else if (arg == "-o")
+        {
+            current->output = value;
+        }
+        else if (arg == "-x")
+        {
+            if (!ParseNumber(arg, value, 0, XDP_MAX_QUEUES - 1, number))
+            {
+                return false;
+            }
+            current->config.rxMode = RxMode::Xdp;
+            current->config.xdpQueue = static_cast<unsigned int>(number);
+        }
+        else if (arg == "-s")
+        {
+            // A zero window would let any stray packet resync the merge
+            if (!ParseNumber(arg, value, 1, MAX_OPTION_USEC, number))
+            {
+                return false;
+            }
+            current->config.maxSkew = std::chrono::microseconds(number);
+        }
+        else if (arg == "-b")
+        {
+            if (!ParseNumber(arg, value, 1, MAX_RX_BATCH, number))
+            {
+                return false;
+            }
+            current->config.rxBatch = static_cast<unsigned int>(number);
+        }
+        else if (arg == "-d")
+        {
+            if (!ParseNumber(arg, value, 0, MAX_OPTION_USEC, number))
+            {
+                return false;
+            }
+            current->config.pacingDelay = std::chrono::microseconds(number);
+        }
+        else if (arg == "-T")
+        {
+            if (value != "mono" && value != "tai")
+            {
+                fprintf(stderr, "Unknown SO_TXTIME clock '%s'\n", value.c_str());
+                return false;
+            }
+            current->config.txTimeClock = (value == "tai") ? CLOCK_TAI : CLOCK_MONOTONIC;
+        }
+        else if (arg == "-f")
+        {
+            std::vector<std::string> fileArgs;
+            if (!ReadConfigFile(value.c_str(), fileArgs))
+            {
+                return false;
+            }
+            args.insert(args.begin() + i + 1, fileArgs.begin(), fileArgs.end());
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+
+    if (explicitSessions.empty() && defaults.legSpecs.empty())
+    {
+        defaults.legSpecs.assign(std::begin(DEFAULT_LEGS), std::end(DEFAULT_LEGS));
+    }
+    if (!defaults.legSpecs.empty())
+    {
+        explicitSessions.insert(explicitSessions.begin(), defaults);
+    }
+
+    for (const SessionArgs& sessionArgs : explicitSessions)
+    {
+        if (sessionArgs.legSpecs.empty())
+        {
+            fprintf(stderr, "Session for %s has no legs\n", sessionArgs.output.c_str());
+            return false;
+        }
+        sessions.push_back(SessionConfig{});
+        if (!BuildSession(sessionArgs, sessions.back()))
+        {
+            return false;
+        }
+    }
+    return true;
+}
 
 //***********************************************************************************
 // Main
 //***********************************************************************************
-int main()
+int main(int argc, char** argv)
 {
+    // Start-up messages go straight out; the packet path logs through Logger
+    setvbuf(stdout, nullptr, _IOLBF, 0);
     printf("\nStarting RX script\n");
 
-    printf("\nCreating Player 1\n");
-    Player txOne{};
-    txOne.Start();
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::vector<SessionConfig> sessionConfigs;
+    ProcessConfig process;
+    if (!ParseArgs(argc, argv, sessionConfigs, process))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+    Logger::SetLevel(process.logLevel);
+
+    // Each loop's io_uring lives on the NUMA node of the CPU it is pinned to
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    for (unsigned int i = 0; i < process.ioThreads; ++i)
+    {
+        int cpu = process.cpus.empty() ? -1 : static_cast<int>(process.cpus[i % process.cpus.size()]);
+        NumaScope scope{cpu >= 0 ? CpuNumaNode(cpu) : -1};
+        loops.emplace_back(new EventLoop{process.useUring, cpu, process.fifoPriority, process.spinUs});
+    }
+
+    size_t legCount = 0;
+    bool useXdp = false;
+    for (const SessionConfig& config : sessionConfigs)
+    {
+        legCount += config.legs.size();
+        useXdp = useXdp || config.output.rxMode == RxMode::Xdp;
+    }
+    // The pool is filled by the NIC, so it goes on the NIC's node (that of
+    // the first leg's interface), or else with the first loop
+    int poolNode = InterfaceNumaNode(sessionConfigs.front().legs.front().ifceName);
+    if (poolNode < 0)
+    {
+        poolNode = loops.front()->NumaNode();
+    }
+    {
+        NumaScope scope{poolNode};
+        // AF_XDP receives straight into the pool, so its slots must be UMEM frames
+        RxPool.reset(new PacketPool<RtpHackPacket>(legCount * PACKET_POOL_SLOTS_PER_LEG,
+                                                   useXdp ? XDP_FRAME_SIZE
+                                                   : process.useUring ? RTP_PACKET_SIZE + RX_URING_HEADROOM
+                                                   : RTP_PACKET_SIZE));
+        PreferNumaNode(RxPool->Data(0), static_cast<size_t>(RxPool->Capacity()) * RxPool->SlotSize(), poolNode);
+    }
+    if (useXdp)
+    {
+        // The UMEM is pinned once per interface
+        struct rlimit unlimited = {RLIM_INFINITY, RLIM_INFINITY};
+        setrlimit(RLIMIT_MEMLOCK, &unlimited);
+    }
+
+    // All per-session and per-leg state is sized here, once; nothing on the
+    // packet path allocates. Players and legs are spread round-robin over
+    // the event loops, and each session (its jitter buffer and leg rings)
+    // is allocated on the node of its player's loop, or else its NIC's.
+    std::vector<std::unique_ptr<Session>> sessions;
+    std::map<std::string, std::unique_ptr<XdpPort>> xdpPorts;
+    unsigned int legNumber = 0;
+    size_t next = 0;
+    for (const SessionConfig& config : sessionConfigs)
+    {
+        EventLoop& playerLoop = *loops[next++ % loops.size()];
+        int node = playerLoop.NumaNode();
+        if (node < 0)
+        {
+            node = InterfaceNumaNode(config.legs.front().ifceName);
+        }
+        {
+            NumaScope scope{node};
+            printf("\nCreating Session %zu\n", sessions.size() + 1);
+            sessions.emplace_back(new Session{config, legNumber});
+        }
+
+        Session* session = sessions.back().get();
+        playerLoop.AddPlayer(session->Output());
+        printf("Sending Packets on %s:%u\n", session->Output().OutputIp().c_str(), session->Output().OutputPort());
+        for (size_t i = 0; i < config.legs.size(); ++i)
+        {
+            Receiver& receiver = *session->Legs()[i];
+            if (config.output.rxMode != RxMode::Xdp)
+            {
+                loops[next++ % loops.size()]->AddReceiver(receiver);
+                continue;
+            }
 
-    printf("\nCreating Receiver 1\n");
-    Receiver rxOne{"239.2.41.22", 1234, "enp1s0", "file1.txt"};
-    Receiver rxTwo{"239.2.41.33", 1234, "enp1s0", "file2.txt"};
+            const LegConfig& leg = config.legs[i];
+            std::unique_ptr<XdpPort>& port = xdpPorts[leg.ifceName];
+            if (!port)
+            {
+                port.reset(new XdpPort{leg.ifceName, config.output.xdpQueue});
+            }
+            else if (port->Queue() != config.output.xdpQueue)
+            {
+                fprintf(stderr, "AF_XDP legs on %s must share one queue\n", leg.ifceName.c_str());
+                return 1;
+            }
+            port->AddFlow(leg.group, leg.port, receiver);
+        }
+    }
+    for (auto& entry : xdpPorts)
+    {
+        entry.second->Open();
+        loops[next++ % loops.size()]->AddXdpPort(*entry.second);
+    }
 
-    rxOne.Start();
-    rxTwo.Start();
+    MetricsRegistry metrics;
+    for (size_t i = 0; i < sessions.size(); ++i)
+    {
+        sessions[i]->RegisterMetrics(metrics, i + 1);
+    }
+    std::unique_ptr<MetricsExporter> exporter;
+    if (!process.metricsFile.empty() || process.metricsPort)
+    {
+        exporter.reset(new MetricsExporter{metrics, METRICS_PERIOD});
+        if (!process.metricsFile.empty())
+        {
+            exporter->WriteFile(process.metricsFile);
+        }
+        if (process.metricsPort)
+        {
+            try
+            {
+                exporter->Listen(process.metricsPort);
+            }
+            catch (const std::system_error& e)
+            {
+                fprintf(stderr, "Metrics port %u: %s\n", process.metricsPort, e.what());
+                return 1;
+            }
+        }
+        exporter->Start();
+    }
 
-//    std::this_thread::sleep_for(std::chrono::milliseconds(2000));
-    //m_condVariable.notify_all();
+    for (auto& loop : loops)
+    {
+        loop->Start();
+    }
 
     while(true)
     {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
     }
     return 0;
 }
-
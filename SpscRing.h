@@ -0,0 +1,164 @@
+#ifndef SPSCRING_H_
+#define SPSCRING_H_
+//------------------------------------------------------------------------------
+//
+// Project: Hack2018
+// Module: SpscRing
+// File: SpscRing.h
+//
+//------------------------------------------------------------------------------
+/// @file
+/// @brief This file contains the SpscRing class template.
+/// The ring is a bounded, wait-free single-producer/single-consumer FIFO.
+///
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// System include files.
+//------------------------------------------------------------------------------
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <stddef.h>
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Project include files.
+//------------------------------------------------------------------------------
+#include "CacheLine.h"
+
+//------------------------------------------------------------------------------
+//
+template<typename T> class SpscRing : public CacheAligned
+//
+/// @brief This class passes items from exactly one producer thread to exactly
+/// one consumer thread without locks. Push() and Pop() each complete in a
+/// bounded number of steps. The producer and consumer indices live on
+/// separate cache lines, and each side keeps a cached copy of the other's
+/// index so that the shared line is only read when the ring looks full or
+/// empty.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    /// @brief Constructor.
+    /// @param capacity the number of items the ring can hold, rounded up to a
+    /// power of two.
+    explicit SpscRing(size_t capacity)
+        :
+        m_capacity(RoundUp(capacity)),
+        m_mask(m_capacity - 1),
+        m_items(new T[m_capacity]),
+        m_head(0),
+        m_tailCache(0),
+        m_tail(0),
+        m_headCache(0)
+    {}
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    SpscRing( const SpscRing& ) = delete;
+    SpscRing( SpscRing&& ) = delete;
+    SpscRing& operator=( SpscRing&& ) = delete;
+    SpscRing& operator=( const SpscRing& ) = delete;
+
+    /// @brief Appends an item. Producer side only.
+    /// @return false if the ring is full.
+    bool Push(const T& item)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_headCache == m_capacity)
+        {
+            m_headCache = m_head.load(std::memory_order_acquire);
+            if (tail - m_headCache == m_capacity)
+            {
+                return false;
+            }
+        }
+        m_items[tail & m_mask] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Removes the oldest item. Consumer side only.
+    /// @return false if the ring is empty.
+    bool Pop(T& item)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tailCache)
+        {
+            m_tailCache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tailCache)
+            {
+                return false;
+            }
+        }
+        item = m_items[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Reads the oldest item without removing it. Consumer side only.
+    /// @return false if the ring is empty.
+    bool Peek(T& item)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tailCache)
+        {
+            m_tailCache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tailCache)
+            {
+                return false;
+            }
+        }
+        item = m_items[head & m_mask];
+        return true;
+    }
+
+    /// @brief Tests if the ring is empty. Exact on the consumer side only.
+    bool Empty() const
+    {
+        return m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_acquire);
+    }
+
+    /// @brief Obtains the number of items the ring can hold.
+    size_t Capacity() const
+    {
+        return m_capacity;
+    }
+
+protected:
+    static size_t RoundUp(size_t n)
+    {
+        if (n == 0)
+        {
+            throw std::invalid_argument("SpscRing: zero capacity");
+        }
+        size_t p = 1;
+        while (p < n)
+        {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    const size_t         m_capacity;
+    const size_t         m_mask;
+    std::unique_ptr<T[]> m_items;
+
+    // Consumer-owned line
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_head;
+    size_t               m_tailCache;
+
+    // Producer-owned line
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_tail;
+    size_t               m_headCache;
+};
+
+//------------------------------------------------------------------------------
+// End of file
+//------------------------------------------------------------------------------
+#endif // SPSCRING_H_
@@ -10,7 +10,9 @@
 //------------------------------------------------------------------------------
 /// @file
 /// @brief This file contains the XPO3 ThreadSafeQueue class template.
-/// The queue is an optionally bounded FIFO.
+/// The queue is an optionally bounded FIFO, stored in a std::list or in a
+/// RingBuffer allocated up front, with an optional index of its items by key,
+/// a choice of what to do when full, and watermark callbacks.
 ///
 //------------------------------------------------------------------------------
 //
@@ -35,40 +37,191 @@
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <functional>
 #include <algorithm>
 #include <memory>
 #include <chrono>
+#include <iterator>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <stdint.h>
-#include <set>
 
 //------------------------------------------------------------------------------
 // Project include files.
 //------------------------------------------------------------------------------
+#include "RingBuffer.h"
 
-namespace
+/// @brief What a bounded ThreadSafeQueue does with a push when it is full.
+enum class OverflowPolicy
 {
-} // namespace
+    DropOldest,     // discard the oldest item to make room (counted dropped)
+    DropNewest,     // discard the item pushed (counted dropped)
+    Block,          // wait for room, up to the block timeout (then rejected)
+    Reject          // refuse the item, leaving it with the caller (counted rejected)
+};
 
+/// @brief Key extractor for ThreadSafeQueue: an item's seqNumber member.
+struct SeqNumberKey
+{
+    template<typename T> auto operator()(const T& item) const -> decltype(item.seqNumber)
+    {
+        return item.seqNumber;
+    }
+};
+
+/// @brief Key extractor for ThreadSafeQueue that leaves the queue unindexed.
+struct NoKey
+{};
 
 //------------------------------------------------------------------------------
 //
-template<typename T> class ThreadSafeQueue
+template<typename Container, typename KeyOf> class QueueIndex
+//
+/// @brief This class maps the key of every item in a ThreadSafeQueue to the
+/// item's place in the storage, in a hash table, so that items can be counted
+/// and found by key in constant time. Those places must stay valid while
+/// other items come and go, which only std::list storage guarantees.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    typedef typename Container::value_type T;
+    typedef typename Container::iterator Iterator;
+    typedef typename std::decay<decltype(std::declval<const KeyOf&>()(std::declval<const T&>()))>::type Key;
+
+    static_assert(std::is_same<Container, std::list<T>>::value, "A keyed ThreadSafeQueue needs std::list storage");
+
+    /// @brief Indexes the item just appended to queue.
+    void Appended(Container& queue)
+    {
+        Iterator it = std::prev(queue.end());
+        m_index.insert(std::make_pair(m_keyOf(*it), it));
+    }
+
+    /// @brief Forgets an item about to be removed.
+    void Erase(Iterator it)
+    {
+        auto range = m_index.equal_range(m_keyOf(*it));
+        for (auto entry = range.first; entry != range.second; ++entry)
+        {
+            if (entry->second == it)
+            {
+                m_index.erase(entry);
+                return;
+            }
+        }
+    }
+
+    /// @brief Finds an item with the given key.
+    /// @return the item, or end if there is none.
+    Iterator Find(const Key& key, Iterator end) const
+    {
+        auto entry = m_index.find(key);
+        return entry == m_index.end() ? end : entry->second;
+    }
+
+    size_t Count(const Key& key) const
+    {
+        return m_index.count(key);
+    }
+
+    void Clear()
+    {
+        m_index.clear();
+    }
+
+    /// @brief Takes over the entries of another index, whose items have been
+    /// spliced onto the end of this one's.
+    void Merge(QueueIndex& other)
+    {
+        if (m_index.empty())
+        {
+            m_index.swap(other.m_index);
+            return;
+        }
+        m_index.insert(other.m_index.begin(), other.m_index.end());
+        other.m_index.clear();
+    }
+
+protected:
+    KeyOf                                  m_keyOf;
+    std::unordered_multimap<Key, Iterator> m_index;
+};
+
+/// @brief The index of an unkeyed queue, which does nothing.
+template<typename Container> class QueueIndex<Container, NoKey>
+{
+public:
+    typedef typename Container::iterator Iterator;
+
+    void Appended(Container&)
+    {}
+
+    void Erase(Iterator)
+    {}
+
+    void Clear()
+    {}
+
+    void Merge(QueueIndex&)
+    {}
+};
+
+//------------------------------------------------------------------------------
+//
+template<typename T, typename Container = std::list<T>, typename KeyOf = SeqNumberKey> class ThreadSafeQueue
 //
 /// @brief This class provides a wrapper around an std::queue to make it safe
 /// for concurrent access by multiple threads. It provides the ability to block
 /// a thread on an empty queue while it is waiting for an element to be placed
 /// in the queue.
 ///
+/// Container is the storage: std::list (the default) or RingBuffer. A
+/// RingBuffer is allocated once at construction for maxEntries items, after
+/// which a bounded queue pushes and pops without allocating; see
+/// ThreadSafeRingQueue.
+///
+/// KeyOf extracts a key from an item; by default its seqNumber. Every
+/// operation keeps a hashed index from key to item up to date, so Count()
+/// and PopByKey() take constant time. NoKey drops the index, which a
+/// RingBuffer needs as erasing from it moves the items behind.
+///
+/// A bounded queue applies its OverflowPolicy when a push finds it full, and
+/// counts the items it drops or rejects. Watermark callbacks report when the
+/// queue fills to its high watermark and when it next drains to its low
+/// watermark, so producers can see backpressure before anything is lost.
+///
 //------------------------------------------------------------------------------
 {
 public:
-    explicit ThreadSafeQueue(const uint32_t maxEntries = 0)
+    /// @brief Constructor.
+    /// @param maxEntries the most items the queue holds, or 0 for no limit.
+    /// @param policy what a push does when the queue is full.
+    /// @param blockTimeout with OverflowPolicy::Block, the longest a push
+    /// waits for room; zero to wait indefinitely.
+    explicit ThreadSafeQueue(const uint32_t maxEntries = 0,
+                             OverflowPolicy policy = OverflowPolicy::DropOldest,
+                             std::chrono::milliseconds blockTimeout = std::chrono::milliseconds::zero())
         :
         m_mutex(),
         m_queue(),
         m_conditionVariable(),
-        m_maxEntries(maxEntries)
-    {}
+        m_notFull(),
+        m_maxEntries(maxEntries),
+        m_policy(policy),
+        m_blockTimeout(blockTimeout),
+        m_dropped(0),
+        m_rejected(0),
+        m_highWatermark(0),
+        m_lowWatermark(0),
+        m_aboveHigh(false),
+        m_onHigh(),
+        m_onLow(),
+        m_index()
+    {
+        Reserve(m_queue, maxEntries);
+    }
 
     /// @brief virtual destructor
     virtual ~ThreadSafeQueue()
@@ -81,54 +234,167 @@ public:
     ThreadSafeQueue& operator=( const ThreadSafeQueue& ) = delete;
 
     /// @brief Appends all items from a source queue onto this one
-    ///
+    /// With std::list storage the items are spliced across in constant time.
+    /// A bounded queue first discards the oldest items that would not fit,
+    /// its own and then the source's, so a RingBuffer never grows past
+    /// maxEntries. Under any other overflow policy only the items that fit
+    /// are moved, one by one, and the rest stay in the source.
     /// @param srcQueue The queue from which to move all items across
-    /// @return number of items moved
-    size_t AppendAllItems(ThreadSafeQueue<T>& srcQueue)
+    /// @return number of items taken from the source
+    size_t AppendAllItems(ThreadSafeQueue<T, Container, KeyOf>& srcQueue)
     {
-        std::lock_guard<std::mutex> srcMutex(srcQueue.m_mutex);
-        std::lock_guard<std::mutex> theMutex(m_mutex);
-        bool itemsAdded = false;
+        std::unique_lock<std::mutex> srcMutex(srcQueue.m_mutex, std::defer_lock);
+        std::unique_lock<std::mutex> theMutex(m_mutex, std::defer_lock);
+        // Both at once, so two queues appending to each other cannot deadlock
+        std::lock(srcMutex, theMutex);
         size_t numberOfMovedItems = srcQueue.m_queue.size();
+        if (numberOfMovedItems == 0)
+        {
+            return 0;
+        }
 
-        while (!srcQueue.m_queue.empty())
+        if (m_maxEntries && m_policy != OverflowPolicy::DropOldest
+            && m_queue.size() + numberOfMovedItems > m_maxEntries)
+        {
+            numberOfMovedItems = 0;
+            while (m_queue.size() < m_maxEntries && !srcQueue.m_queue.empty())
+            {
+                PushBack(srcQueue.PopFront());
+                ++numberOfMovedItems;
+            }
+        }
+        else
         {
-            MakeRoom();
-            T item = std::move(srcQueue.m_queue.front());
-            srcQueue.m_queue.pop_front();
-            m_queue.push_back(std::move(item));
-            itemsAdded = true;
+            if (m_maxEntries)
+            {
+                // The sizes passed on the way are not reported, only the end
+                m_dropped += srcQueue.Trim(m_maxEntries);
+                m_dropped += Trim(m_maxEntries - srcQueue.m_queue.size());
+            }
+            m_queue.splice(m_queue.end(), srcQueue.m_queue);
+            // A RingBuffer may have swapped arrays with the source
+            Reserve(m_queue, m_maxEntries);
+            Reserve(srcQueue.m_queue, srcQueue.m_maxEntries);
+            m_index.Merge(srcQueue.m_index);
+            srcQueue.Drained();
+            CheckWatermarks();
         }
 
-        if (itemsAdded)
+        if (numberOfMovedItems)
+        {
+            m_conditionVariable.notify_all();
+        }
+        return numberOfMovedItems;
+    }
+
+    /// @brief Pushes a range of items into the queue under one lock, with
+    /// one wake-up. Pass move iterators to move the items in. When the
+    /// queue fills, DropNewest drops each remaining item, while Reject and a
+    /// timed out Block stop at the first item refused.
+    /// @param first the first item to push.
+    /// @param last one past the last item to push.
+    /// @return number of items pushed.
+    template<typename InputIterator> size_t PushBatch(InputIterator first, InputIterator last)
+    {
+        std::unique_lock<std::mutex> theMutex(m_mutex);
+        size_t numberOfPushedItems = 0;
+        for (; first != last; ++first)
+        {
+            if (!MakeRoom(theMutex))
+            {
+                if (m_policy == OverflowPolicy::DropNewest)
+                {
+                    continue;
+                }
+                break;
+            }
+            PushBack(*first);
+            ++numberOfPushedItems;
+        }
+        if (numberOfPushedItems == 1)
         {
             m_conditionVariable.notify_one();
         }
+        else if (numberOfPushedItems > 1)
+        {
+            m_conditionVariable.notify_all();
+        }
+        return numberOfPushedItems;
+    }
+
+    /// @brief Waits until either an item is available or a timeout, then
+    /// pops as many items as are available, up to maxItems, under one lock.
+    /// @param items the buffer receiving the items popped.
+    /// @param maxItems the size of the buffer.
+    /// @param duration the timeout; zero to take only what is there.
+    /// @return number of items popped, 0 if timedout.
+    template<class Rep, class Period>
+    size_t PopBatch(T* items, size_t maxItems, const std::chrono::duration<Rep, Period>& duration)
+    {
+        std::chrono::duration<Rep, Period> nonConstDuration = duration;
+        std::unique_lock<std::mutex> theMutex(m_mutex);
+        if (maxItems == 0 || (m_queue.empty() && !Wait(nonConstDuration, theMutex)))
+        {
+            return 0;
+        }
+        size_t numberOfPoppedItems = 0;
+        while (numberOfPoppedItems < maxItems && !m_queue.empty())
+        {
+            items[numberOfPoppedItems++] = PopFront();
+        }
+        return numberOfPoppedItems;
+    }
+
+    /// @brief Moves every item in the queue onto the end of items under one
+    /// lock, without waiting. Constant time with std::list storage, and with
+    /// RingBuffer storage when items is empty: the two then swap arrays, so
+    /// pass one reserved for maxEntries to keep the queue allocation-free.
+    /// @param items the container receiving the items.
+    /// @return number of items moved.
+    size_t PopAll(Container& items)
+    {
+        std::lock_guard<std::mutex> theMutex(m_mutex);
+        size_t numberOfMovedItems = m_queue.size();
+        items.splice(items.end(), m_queue);
+        Reserve(m_queue, m_maxEntries);
+        m_index.Clear();
+        Drained();
         return numberOfMovedItems;
     }
 
     /// @brief Pushes an item into the queue.
     /// This method retains a valid user copy of the pushed item.
     /// @param item the new item to be pushed onto the queue.
-    void Push( const T& item )
+    /// @return true if queued, false if the overflow policy dropped or
+    /// rejected the item.
+    bool Push( const T& item )
     {
-        std::lock_guard<std::mutex> theMutex(m_mutex);
-        MakeRoom();
-        m_queue.push_back(item);
-        m_set.insert(item.seqNumber);
+        std::unique_lock<std::mutex> theMutex(m_mutex);
+        if (!MakeRoom(theMutex))
+        {
+            return false;
+        }
+        PushBack(item);
         m_conditionVariable.notify_one();
+        return true;
     }
 
     /// @brief Pushes an item into the queue.
-    /// This method invalidates user copy of the pushed item.
+    /// This method invalidates user copy of the pushed item, unless the
+    /// item is not queued.
     /// @param item the new item to be pushed onto the queue.
-    void Push( T&& item )
+    /// @return true if queued, false if the overflow policy dropped or
+    /// rejected the item.
+    bool Push( T&& item )
     {
-        std::lock_guard<std::mutex> theMutex(m_mutex);
-        MakeRoom();
-        m_queue.push_back(std::move(item));
-        m_set.insert(item.seqNumber);
+        std::unique_lock<std::mutex> theMutex(m_mutex);
+        if (!MakeRoom(theMutex))
+        {
+            return false;
+        }
+        PushBack(std::move(item));
         m_conditionVariable.notify_one();
+        return true;
     }
 
     /// @brief Waits indefinetelly on an empty queue, popping the next
@@ -138,10 +404,7 @@ public:
     {
         std::unique_lock<std::mutex> theMutex(m_mutex);
         m_conditionVariable.wait(theMutex, [this]{ return !m_queue.empty(); });
-        T item = std::move(m_queue.front());
-        m_set.erase(item.seqNumber);
-        m_queue.pop_front();
-        return item;
+        return PopFront();
     }
 
     /// @brief Waits until either an item is available or a timeout, popping the next
@@ -177,9 +440,7 @@ public:
         std::unique_lock<std::mutex> theMutex(m_mutex);
         if (Wait(duration, theMutex))
         {
-            item = std::move(m_queue.front());
-            m_set.erase(item.seqNumber);
-            m_queue.pop_front();
+            item = PopFront();
             return true;
         }
         return false;
@@ -205,8 +466,7 @@ public:
         {
             return false;
         }
-        item = std::move(m_queue.front());
-        m_queue.pop_front();
+        item = PopFront();
         return true;
     }
 
@@ -252,25 +512,214 @@ public:
     void Clear()
     {
         std::lock_guard<std::mutex> theMutex(m_mutex);
-        std::list<T>().swap(m_queue);
+        m_queue.clear();
+        m_index.Clear();
+        Drained();
+    }
+
+    /// @brief Sets the watermarks and their callbacks. onHigh is called when
+    /// the queue fills to highWatermark items; onLow when it next drains to
+    /// lowWatermark, after which onHigh may be called again. Both receive the
+    /// size of the queue. They are called with the queue locked, from the
+    /// thread that crossed the mark, so they must be quick and must not use
+    /// the queue.
+    /// @param highWatermark the size that calls onHigh, or 0 for none.
+    /// @param lowWatermark the size that calls onLow, below highWatermark.
+    void SetWatermarks(size_t highWatermark, size_t lowWatermark,
+                       std::function<void(size_t)> onHigh, std::function<void(size_t)> onLow)
+    {
+        std::lock_guard<std::mutex> theMutex(m_mutex);
+        m_highWatermark = highWatermark;
+        m_lowWatermark = lowWatermark;
+        m_onHigh = std::move(onHigh);
+        m_onLow = std::move(onLow);
+        m_aboveHigh = false;
+        CheckWatermarks();
+    }
+
+    /// @brief Obtains the number of items discarded by DropOldest or
+    /// DropNewest, or to bound an AppendAllItems().
+    uint64_t Dropped() const
+    {
+        std::lock_guard<std::mutex> theMutex(m_mutex);
+        return m_dropped;
+    }
+
+    /// @brief Obtains the number of items refused by Reject, or by Block
+    /// after its timeout.
+    uint64_t Rejected() const
+    {
+        std::lock_guard<std::mutex> theMutex(m_mutex);
+        return m_rejected;
     }
 
-    int Count(int seqNumber)
+    /// @brief Counts the items with the given key. Keyed queues only.
+    /// @return number of items in the queue with the key.
+    template<typename Key> size_t Count(const Key& key) const
     {
         std::lock_guard<std::mutex> theMutex(m_mutex);
-        return m_set.count(seqNumber);
+        return m_index.Count(key);
     }
+
+    /// @brief Tries to pop an item with the given key, wherever it is in the
+    /// queue, in constant time. Keyed queues only. If several items share
+    /// the key, which of them is popped is unspecified.
+    /// @param item the returned item.
+    /// @param key the key of the item wanted.
+    /// @return true if successful, false if no item has the key.
+    template<typename Key> bool PopByKey(T& item, const Key& key)
+    {
+        std::lock_guard<std::mutex> theMutex(m_mutex);
+        auto it = m_index.Find(key, m_queue.end());
+        if (it == m_queue.end())
+        {
+            return false;
+        }
+        item = Erase(it);
+        return true;
+    }
+
 protected:
-    void MakeRoom()
+    static void Reserve(std::list<T>&, uint32_t)
+    {}
+
+    static void Reserve(RingBuffer<T>& ring, uint32_t maxEntries)
+    {
+        ring.Reserve(maxEntries);
+    }
+
+    /// @brief Discards the oldest entries beyond maxItems, leaving the
+    /// watermarks for the caller to check once the size has settled.
+    /// @return number of entries discarded.
+    size_t Trim(size_t maxItems)
+    {
+        size_t discarded = 0;
+        while (m_queue.size() > maxItems)
+        {
+            m_index.Erase(m_queue.begin());
+            m_queue.pop_front();
+            ++discarded;
+        }
+        return discarded;
+    }
+
+    /// @brief Reports a crossing of either watermark, if any.
+    void CheckWatermarks()
     {
-        if (m_maxEntries)
+        if (!m_aboveHigh)
+        {
+            if (m_highWatermark && m_queue.size() >= m_highWatermark)
+            {
+                m_aboveHigh = true;
+                if (m_onHigh)
+                {
+                    m_onHigh(m_queue.size());
+                }
+            }
+        }
+        else if (m_queue.size() <= m_lowWatermark)
+        {
+            m_aboveHigh = false;
+            if (m_onLow)
+            {
+                m_onLow(m_queue.size());
+            }
+        }
+    }
+
+    /// @brief Follows up the removal of one item.
+    void Removed()
+    {
+        CheckWatermarks();
+        if (m_policy == OverflowPolicy::Block)
+        {
+            m_notFull.notify_one();
+        }
+    }
+
+    /// @brief Follows up the removal of every item at once.
+    void Drained()
+    {
+        CheckWatermarks();
+        if (m_policy == OverflowPolicy::Block)
+        {
+            m_notFull.notify_all();
+        }
+    }
+
+    /// @brief Appends an item and indexes it.
+    template<typename U> void PushBack(U&& item)
+    {
+        m_queue.push_back(std::forward<U>(item));
+        m_index.Appended(m_queue);
+        CheckWatermarks();
+    }
+
+    /// @brief Removes the oldest item from the queue and the index.
+    /// @return the item.
+    T PopFront()
+    {
+        m_index.Erase(m_queue.begin());
+        T item = std::move(m_queue.front());
+        m_queue.pop_front();
+        Removed();
+        return item;
+    }
+
+    /// @brief Removes an item from the queue and the index.
+    /// @return the item.
+    T Erase(typename Container::iterator it)
+    {
+        m_index.Erase(it);
+        T item = std::move(*it);
+        m_queue.erase(it);
+        Removed();
+        return item;
+    }
+
+    /// @brief Makes room for one more item as the overflow policy says.
+    /// @param theMutex the held lock, released while Block waits.
+    /// @return true if the item may be pushed.
+    bool MakeRoom(std::unique_lock<std::mutex>& theMutex)
+    {
+        if (m_maxEntries == 0 || m_queue.size() < m_maxEntries)
+        {
+            return true;
+        }
+        if (m_policy == OverflowPolicy::DropOldest)
         {
             // Discard oldest entries to ensure maximum size is not exceeded
             while (m_queue.size() >= m_maxEntries)
             {
-                m_queue.pop_front();
+                PopFront();
+                ++m_dropped;
+            }
+            return true;
+        }
+        if (m_policy == OverflowPolicy::Block)
+        {
+            // Items pushed earlier in a batch have not been announced yet
+            m_conditionVariable.notify_all();
+            auto hasRoom = [this]{ return m_queue.size() < m_maxEntries; };
+            if (m_blockTimeout == std::chrono::milliseconds::zero())
+            {
+                m_notFull.wait(theMutex, hasRoom);
+                return true;
+            }
+            if (m_notFull.wait_for(theMutex, m_blockTimeout, hasRoom))
+            {
+                return true;
             }
         }
+        if (m_policy == OverflowPolicy::DropNewest)
+        {
+            ++m_dropped;
+        }
+        else
+        {
+            ++m_rejected;
+        }
+        return false;
     }
 
     /// @brief Waits until either an item is available or a timeout.
@@ -316,8 +765,7 @@ protected:
         auto it = std::find_if(m_queue.begin(), m_queue.end(), condition);
         if (it != m_queue.end())
         {
-            item = std::move(*it);
-            m_queue.erase(it);
+            item = Erase(it);
             return true;
         }
         return false;
@@ -328,12 +776,26 @@ protected:
     // physical state of the object). However, the logical state of the object, in particular
     // that of the underlying queue itself, remains unchanged throughout.
     mutable std::mutex      m_mutex;
-    std::list<T>            m_queue;
+    Container               m_queue;
     std::condition_variable m_conditionVariable;
+    std::condition_variable m_notFull;          // producers blocked by OverflowPolicy::Block
     uint32_t                m_maxEntries;
-    std::set<int>           m_set;
+    OverflowPolicy          m_policy;
+    std::chrono::milliseconds m_blockTimeout;
+    uint64_t                m_dropped;
+    uint64_t                m_rejected;
+    size_t                  m_highWatermark;
+    size_t                  m_lowWatermark;
+    bool                    m_aboveHigh;
+    std::function<void(size_t)> m_onHigh;
+    std::function<void(size_t)> m_onLow;
+    QueueIndex<Container, KeyOf> m_index;
 };
 
+/// @brief An unkeyed ThreadSafeQueue whose storage is allocated once, up
+/// front, for maxEntries items.
+template<typename T> using ThreadSafeRingQueue = ThreadSafeQueue<T, RingBuffer<T>, NoKey>;
+
 //------------------------------------------------------------------------------
 // End of file
 //------------------------------------------------------------------------------
@@ -0,0 +1,544 @@
+#ifndef XDPSOCKET_H_
+#define XDPSOCKET_H_
+//------------------------------------------------------------------------------
+//
+// Project: Hack2018
+// Module: XdpSocket
+// File: XdpSocket.h
+//
+//------------------------------------------------------------------------------
+/// @file
+/// @brief This file contains the XdpProgram and XdpSocket classes.
+/// Together they steer chosen UDP flows on an interface into an AF_XDP socket
+/// whose UMEM is memory owned by the caller. Both are made directly on the
+/// bpf() and socket system calls, so that no libbpf or libxdp is needed.
+///
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module include files.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// System include files.
+//------------------------------------------------------------------------------
+#include <atomic>
+#include <string>
+#include <system_error>
+#include <vector>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+//------------------------------------------------------------------------------
+// Project include files.
+//------------------------------------------------------------------------------
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+//------------------------------------------------------------------------------
+//
+class XdpProgram
+//
+/// @brief This class loads and attaches an XDP program to one interface. The
+/// program redirects unfragmented IPv4 UDP packets, without IP options, whose
+/// destination address and port are in its flow table to the AF_XDP socket
+/// registered for the receive queue they arrived on. Everything else passes
+/// to the network stack.
+///
+/// The program is attached through a BPF link, in driver mode where the
+/// driver supports it and in generic (SKB) mode otherwise, and detaches when
+/// the object is destroyed or the process exits.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    /// @brief Constructor.
+    /// @param ifindex the interface to attach to.
+    /// @param maxFlows the flow table size.
+    /// @param maxQueues the number of receive queues sockets can be bound to.
+    /// @throw std::system_error if the program cannot be loaded or attached.
+    XdpProgram(unsigned int ifindex, uint32_t maxFlows, uint32_t maxQueues)
+        :
+        m_flowsFd(-1),
+        m_socketsFd(-1),
+        m_progFd(-1),
+        m_linkFd(-1),
+        m_generic(false)
+    {
+        try
+        {
+            m_flowsFd = CreateMap(BPF_MAP_TYPE_HASH, sizeof(FlowKey), sizeof(uint32_t), maxFlows);
+            m_socketsFd = CreateMap(BPF_MAP_TYPE_XSKMAP, sizeof(uint32_t), sizeof(uint32_t), maxQueues);
+            m_progFd = Load();
+            m_linkFd = Attach(ifindex, XDP_FLAGS_DRV_MODE);
+            if (m_linkFd < 0)
+            {
+                m_generic = true;
+                m_linkFd = Attach(ifindex, XDP_FLAGS_SKB_MODE);
+            }
+            if (m_linkFd < 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "BPF_LINK_CREATE for XDP");
+            }
+        }
+        catch (...)
+        {
+            Close();
+            throw;
+        }
+    }
+
+    ~XdpProgram()
+    {
+        Close();
+    }
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    XdpProgram( const XdpProgram& ) = delete;
+    XdpProgram( XdpProgram&& ) = delete;
+    XdpProgram& operator=( XdpProgram&& ) = delete;
+    XdpProgram& operator=( const XdpProgram& ) = delete;
+
+    /// @brief Starts redirecting a flow.
+    /// @param group the destination address, in network byte order.
+    /// @param port the destination port, in network byte order.
+    void AddFlow(uint32_t group, uint16_t port)
+    {
+        FlowKey key;
+        memset(&key, 0, sizeof(key));
+        key.addr = group;
+        key.port = port;
+        uint32_t value = 1;
+        Update(m_flowsFd, &key, &value, "flow table update");
+    }
+
+    /// @brief Registers the AF_XDP socket bound to a receive queue.
+    void AddSocket(uint32_t queue, int xskFd)
+    {
+        uint32_t value = static_cast<uint32_t>(xskFd);
+        Update(m_socketsFd, &queue, &value, "XSKMAP update");
+    }
+
+    /// @brief Tests if the program runs in generic (SKB) mode, in which
+    /// sockets can only use copy mode.
+    bool Generic() const
+    {
+        return m_generic;
+    }
+
+protected:
+    // Matches the key the program builds on its stack
+    struct FlowKey
+    {
+        uint32_t addr;
+        uint16_t port;
+        uint16_t pad;
+    };
+
+    static long Bpf(int cmd, union bpf_attr& attr)
+    {
+        return syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+    }
+
+    static int CreateMap(uint32_t type, uint32_t keySize, uint32_t valueSize, uint32_t entries)
+    {
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.map_type = type;
+        attr.key_size = keySize;
+        attr.value_size = valueSize;
+        attr.max_entries = entries;
+        int fd = static_cast<int>(Bpf(BPF_MAP_CREATE, attr));
+        if (fd < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "BPF_MAP_CREATE");
+        }
+        return fd;
+    }
+
+    static void Update(int mapFd, const void* key, const void* value, const char* what)
+    {
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = mapFd;
+        attr.key = reinterpret_cast<uint64_t>(key);
+        attr.value = reinterpret_cast<uint64_t>(value);
+        attr.flags = BPF_ANY;
+        if (Bpf(BPF_MAP_UPDATE_ELEM, attr) < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+    }
+
+    static struct bpf_insn Insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+    {
+        struct bpf_insn insn;
+        insn.code = code;
+        insn.dst_reg = dst;
+        insn.src_reg = src;
+        insn.off = off;
+        insn.imm = imm;
+        return insn;
+    }
+
+    /// @brief Assembles the program; see the class description.
+    std::vector<struct bpf_insn> Assemble() const
+    {
+        const uint8_t LDX_B = BPF_LDX | BPF_MEM | BPF_B;
+        const uint8_t LDX_H = BPF_LDX | BPF_MEM | BPF_H;
+        const uint8_t LDX_W = BPF_LDX | BPF_MEM | BPF_W;
+        const uint8_t JNE_K = BPF_JMP | BPF_JNE | BPF_K;
+
+        std::vector<struct bpf_insn> prog;
+        std::vector<size_t> toPass;
+        auto passUnless = [&](uint8_t code, uint8_t reg, int32_t imm)
+        {
+            toPass.push_back(prog.size());
+            prog.push_back(Insn(code, reg, 0, 0, imm));
+        };
+        auto loadMap = [&](uint8_t reg, int fd)
+        {
+            prog.push_back(Insn(BPF_LD | BPF_DW | BPF_IMM, reg, BPF_PSEUDO_MAP_FD, 0, fd));
+            prog.push_back(Insn(0, 0, 0, 0, 0));
+        };
+
+        // r6 = ctx, r2 = data, r3 = data_end
+        prog.push_back(Insn(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0));
+        prog.push_back(Insn(LDX_W, 2, 6, offsetof(struct xdp_md, data), 0));
+        prog.push_back(Insn(LDX_W, 3, 6, offsetof(struct xdp_md, data_end), 0));
+        // Ethernet (14) + IPv4 without options (20) + UDP (8) must be present
+        prog.push_back(Insn(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0));
+        prog.push_back(Insn(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, 42));
+        toPass.push_back(prog.size());
+        prog.push_back(Insn(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 0, 0));
+        // Packet loads are little endian, so network order constants are
+        // written byte-swapped
+        prog.push_back(Insn(LDX_H, 5, 2, 12, 0));                          // EtherType
+        passUnless(JNE_K, 5, 0x0008);                                      // IPv4
+        prog.push_back(Insn(LDX_B, 5, 2, 14, 0));                          // version, IHL
+        passUnless(JNE_K, 5, 0x45);
+        prog.push_back(Insn(LDX_B, 5, 2, 23, 0));                          // protocol
+        passUnless(JNE_K, 5, IPPROTO_UDP);
+        prog.push_back(Insn(LDX_H, 5, 2, 20, 0));                          // fragment offset
+        prog.push_back(Insn(BPF_ALU64 | BPF_AND | BPF_K, 5, 0, 0, 0xff1f));
+        passUnless(JNE_K, 5, 0);
+        // key = {destination address, destination port, 0} at r10 - 8
+        prog.push_back(Insn(LDX_W, 5, 2, 30, 0));
+        prog.push_back(Insn(BPF_STX | BPF_MEM | BPF_W, 10, 5, -8, 0));
+        prog.push_back(Insn(LDX_H, 5, 2, 36, 0));
+        prog.push_back(Insn(BPF_STX | BPF_MEM | BPF_H, 10, 5, -4, 0));
+        prog.push_back(Insn(BPF_ST | BPF_MEM | BPF_H, 10, 0, -2, 0));
+        prog.push_back(Insn(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0));
+        prog.push_back(Insn(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -8));
+        loadMap(1, m_flowsFd);
+        prog.push_back(Insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem));
+        passUnless(BPF_JMP | BPF_JEQ | BPF_K, 0, 0);
+        // return bpf_redirect_map(sockets, rx_queue_index, XDP_PASS)
+        prog.push_back(Insn(LDX_W, 2, 6, offsetof(struct xdp_md, rx_queue_index), 0));
+        loadMap(1, m_socketsFd);
+        prog.push_back(Insn(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS));
+        prog.push_back(Insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+        prog.push_back(Insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+        // pass:
+        size_t pass = prog.size();
+        prog.push_back(Insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS));
+        prog.push_back(Insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+        for (size_t jump : toPass)
+        {
+            prog[jump].off = static_cast<int16_t>(pass - jump - 1);
+        }
+        return prog;
+    }
+
+    int Load() const
+    {
+        std::vector<struct bpf_insn> prog = Assemble();
+        static const char license[] = "GPL";
+
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.prog_type = BPF_PROG_TYPE_XDP;
+        attr.expected_attach_type = BPF_XDP;
+        attr.insns = reinterpret_cast<uint64_t>(prog.data());
+        attr.insn_cnt = static_cast<uint32_t>(prog.size());
+        attr.license = reinterpret_cast<uint64_t>(license);
+        int fd = static_cast<int>(Bpf(BPF_PROG_LOAD, attr));
+        if (fd < 0)
+        {
+            // Load again for the verifier's explanation
+            int error = errno;
+            std::vector<char> log(65536);
+            attr.log_buf = reinterpret_cast<uint64_t>(log.data());
+            attr.log_size = static_cast<uint32_t>(log.size());
+            attr.log_level = 1;
+            Bpf(BPF_PROG_LOAD, attr);
+            fprintf(stderr, "XDP program rejected:\n%s\n", log.data());
+            throw std::system_error(error, std::generic_category(), "BPF_PROG_LOAD");
+        }
+        return fd;
+    }
+
+    int Attach(unsigned int ifindex, uint32_t mode) const
+    {
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = m_progFd;
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = mode;
+        return static_cast<int>(Bpf(BPF_LINK_CREATE, attr));
+    }
+
+    void Close()
+    {
+        for (int fd : {m_linkFd, m_progFd, m_socketsFd, m_flowsFd})
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+        m_linkFd = m_progFd = m_socketsFd = m_flowsFd = -1;
+    }
+
+    int  m_flowsFd;
+    int  m_socketsFd;
+    int  m_progFd;
+    int  m_linkFd;
+    bool m_generic;
+};
+
+//------------------------------------------------------------------------------
+//
+class XdpSocket
+//
+/// @brief This class is an AF_XDP socket bound to one receive queue, with a
+/// UMEM over caller-owned memory divided into equal frames. The caller lends
+/// frames to the kernel by address with Fill() and FlushFill(), and takes
+/// back received frames with Peek(), Desc() and Release().
+///
+/// The class is not thread safe; one thread must drive both rings.
+///
+//------------------------------------------------------------------------------
+{
+public:
+    /// @brief Constructor.
+    /// @param ifindex the interface.
+    /// @param queue the receive queue to bind to.
+    /// @param umem the start of the frame memory, page aligned.
+    /// @param umemSize the size of the frame memory, a multiple of frameSize.
+    /// @param frameSize the frame size, a power of two from 2048 to the page
+    /// size.
+    /// @param ringSize the fill and receive ring sizes, a power of two.
+    /// @param zeroCopy true to ask for driver zero-copy, falling back to copy
+    /// mode; false for copy mode only.
+    /// @throw std::system_error if the socket cannot be set up.
+    XdpSocket(unsigned int ifindex, uint32_t queue, void* umem, size_t umemSize, uint32_t frameSize,
+              uint32_t ringSize, bool zeroCopy)
+        :
+        m_fd(-1),
+        m_fill(),
+        m_completion(),
+        m_rx()
+    {
+        m_fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+        if (m_fd < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "AF_XDP socket");
+        }
+
+        try
+        {
+            struct xdp_umem_reg reg;
+            memset(&reg, 0, sizeof(reg));
+            reg.addr = reinterpret_cast<uint64_t>(umem);
+            reg.len = umemSize;
+            reg.chunk_size = frameSize;
+            SetOption(XDP_UMEM_REG, &reg, sizeof(reg), "XDP_UMEM_REG");
+            SetOption(XDP_UMEM_FILL_RING, &ringSize, sizeof(ringSize), "XDP_UMEM_FILL_RING");
+            // Transmit goes through the UDP socket, but the kernel insists on
+            // a completion ring
+            uint32_t one = 1;
+            SetOption(XDP_UMEM_COMPLETION_RING, &one, sizeof(one), "XDP_UMEM_COMPLETION_RING");
+            SetOption(XDP_RX_RING, &ringSize, sizeof(ringSize), "XDP_RX_RING");
+
+            struct xdp_mmap_offsets off;
+            socklen_t offLen = sizeof(off);
+            if (getsockopt(m_fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &offLen) < 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "XDP_MMAP_OFFSETS");
+            }
+            Map(m_fill, off.fr, ringSize, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING);
+            Map(m_completion, off.cr, 1, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING);
+            Map(m_rx, off.rx, ringSize, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING);
+
+            struct sockaddr_xdp addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sxdp_family = AF_XDP;
+            addr.sxdp_ifindex = ifindex;
+            addr.sxdp_queue_id = queue;
+            addr.sxdp_flags = zeroCopy ? XDP_ZEROCOPY : XDP_COPY;
+            int status = bind(m_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+            if (status < 0 && zeroCopy)
+            {
+                addr.sxdp_flags = XDP_COPY;
+                status = bind(m_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+            }
+            if (status < 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "AF_XDP bind");
+            }
+        }
+        catch (...)
+        {
+            Close();
+            throw;
+        }
+    }
+
+    ~XdpSocket()
+    {
+        Close();
+    }
+
+    /// @brief Disable unwanted constructors and assignment operators.
+    XdpSocket( const XdpSocket& ) = delete;
+    XdpSocket( XdpSocket&& ) = delete;
+    XdpSocket& operator=( XdpSocket&& ) = delete;
+    XdpSocket& operator=( const XdpSocket& ) = delete;
+
+    int Fd() const
+    {
+        return m_fd;
+    }
+
+    /// @brief Obtains the number of frames the fill ring can take.
+    uint32_t FillSpace()
+    {
+        return m_fill.size - (m_fill.local - m_fill.consumer->load(std::memory_order_acquire));
+    }
+
+    /// @brief Stages a frame for the kernel to receive into. The caller must
+    /// have checked FillSpace().
+    /// @param addr the frame offset from the start of the UMEM.
+    void Fill(uint64_t addr)
+    {
+        static_cast<uint64_t*>(m_fill.descs)[m_fill.local++ & m_fill.mask] = addr;
+    }
+
+    /// @brief Hands every staged frame to the kernel.
+    void FlushFill()
+    {
+        m_fill.producer->store(m_fill.local, std::memory_order_release);
+    }
+
+    /// @brief Looks for received frames.
+    /// @param max the most frames to take.
+    /// @return the number of frames, which are Desc(0) to Desc(n - 1).
+    uint32_t Peek(uint32_t max)
+    {
+        uint32_t ready = m_rx.producer->load(std::memory_order_acquire) - m_rx.local;
+        return ready < max ? ready : max;
+    }
+
+    /// @brief Obtains the i-th received frame. Its addr is the UMEM offset
+    /// of the packet data, past any headroom.
+    const struct xdp_desc& Desc(uint32_t i) const
+    {
+        return static_cast<const struct xdp_desc*>(m_rx.descs)[(m_rx.local + i) & m_rx.mask];
+    }
+
+    /// @brief Gives the first count received descriptors back to the kernel.
+    /// The frames themselves stay with the caller until filled again.
+    void Release(uint32_t count)
+    {
+        m_rx.local += count;
+        m_rx.consumer->store(m_rx.local, std::memory_order_release);
+    }
+
+protected:
+    // One single-producer/single-consumer ring shared with the kernel. local
+    // is our private copy of the index we own.
+    struct Ring
+    {
+        void*                  map = nullptr;
+        size_t                 mapSize = 0;
+        std::atomic<uint32_t>* producer = nullptr;
+        std::atomic<uint32_t>* consumer = nullptr;
+        void*                  descs = nullptr;
+        uint32_t               size = 0;
+        uint32_t               mask = 0;
+        uint32_t               local = 0;
+    };
+
+    void SetOption(int name, const void* value, socklen_t len, const char* what)
+    {
+        if (setsockopt(m_fd, SOL_XDP, name, value, len) < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+    }
+
+    void Map(Ring& ring, const struct xdp_ring_offset& off, uint32_t size, size_t descSize, off_t pgoff)
+    {
+        ring.mapSize = off.desc + size * descSize;
+        ring.map = mmap(nullptr, ring.mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, pgoff);
+        if (ring.map == MAP_FAILED)
+        {
+            ring.map = nullptr;
+            throw std::system_error(errno, std::generic_category(), "AF_XDP ring mmap");
+        }
+        unsigned char* base = static_cast<unsigned char*>(ring.map);
+        ring.producer = reinterpret_cast<std::atomic<uint32_t>*>(base + off.producer);
+        ring.consumer = reinterpret_cast<std::atomic<uint32_t>*>(base + off.consumer);
+        ring.descs = base + off.desc;
+        ring.size = size;
+        ring.mask = size - 1;
+        // We consume the receive ring and produce the fill ring
+        ring.local = (pgoff == XDP_PGOFF_RX_RING) ? ring.consumer->load() : ring.producer->load();
+    }
+
+    void Close()
+    {
+        for (Ring* ring : {&m_fill, &m_completion, &m_rx})
+        {
+            if (ring->map)
+            {
+                munmap(ring->map, ring->mapSize);
+                ring->map = nullptr;
+            }
+        }
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    int  m_fd;
+    Ring m_fill;
+    Ring m_completion;
+    Ring m_rx;
+};
+
+//------------------------------------------------------------------------------
+// End of file
+//------------------------------------------------------------------------------
+#endif // XDPSOCKET_H_
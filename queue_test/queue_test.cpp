@@ -0,0 +1,554 @@
+//------------------------------------------------------------------------------
+//
+// Project: Hack2018
+// Module: queue_test
+// File: queue_test.cpp
+//
+//------------------------------------------------------------------------------
+/// @file
+/// @brief Self-checking tests for the queue headers. Prints each failed
+/// check and exits non-zero if there were any; "make check" builds and runs
+/// it.
+///
+//------------------------------------------------------------------------------
+
+#include "LockFreeQueue.h"
+#include "RingBuffer.h"
+#include "ThreadSafeQueue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <list>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace
+{
+    int failures = 0;
+
+    // Every allocation in the program, so checks can tell when one happened
+    std::atomic<size_t> allocations(0);
+
+    typedef ThreadSafeQueue<int, std::list<int>, NoKey> IntQueue;
+
+    struct Packet
+    {
+        uint16_t seqNumber;
+        std::string source;
+    };
+
+    struct SourceKey
+    {
+        const std::string& operator()(const Packet& packet) const
+        {
+            return packet.source;
+        }
+    };
+
+    typedef ThreadSafeQueue<Packet> PacketQueue;
+}
+
+#define CHECK(condition)                                                       \
+    do                                                                         \
+    {                                                                          \
+        if (!(condition))                                                      \
+        {                                                                      \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            ++failures;                                                        \
+        }                                                                      \
+    } while (0)
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    if (void* ptr = malloc(size ? size : 1))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+//***********************************************************************************
+// Ring storage
+//***********************************************************************************
+/// @brief Pops everything left in a queue, oldest first.
+template<typename Queue> static std::vector<int> Drain(Queue& queue)
+{
+    std::vector<int> items;
+    int item;
+    while (queue.TryPop(item))
+    {
+        items.push_back(item);
+    }
+    return items;
+}
+
+static void TestRingStorage()
+{
+    printf("Ring storage\n");
+
+    // Wrapping round, and erasing from the middle
+    RingBuffer<int> ring;
+    ring.Reserve(4);
+    for (int i = 0; i < 3; ++i)
+    {
+        ring.push_back(i);
+    }
+    ring.pop_front();
+    ring.pop_front();
+    ring.push_back(3);
+    ring.push_back(4);
+    ring.push_back(5);
+    CHECK(ring.size() == 4 && ring.Capacity() == 4);
+    auto it = ring.begin();
+    ++it;
+    it = ring.erase(it);
+    CHECK(*it == 4);
+    std::vector<int> held(ring.begin(), ring.end());
+    CHECK((held == std::vector<int>{2, 4, 5}));
+
+    // Growing keeps the items in order
+    for (int i = 6; i < 10; ++i)
+    {
+        ring.push_back(i);
+    }
+    held.assign(ring.begin(), ring.end());
+    CHECK((held == std::vector<int>{2, 4, 5, 6, 7, 8, 9}));
+    CHECK(ring.Capacity() == 8);
+
+    // Once constructed, a bounded ring queue never allocates
+    ThreadSafeRingQueue<int> queue(8);
+    size_t before = allocations.load();
+    for (int i = 0; i < 20; ++i)
+    {
+        queue.Push(i);
+    }
+    int item = -1;
+    CHECK(queue.TryPop(item) && item == 12);
+    CHECK(queue.PopIf(item, [](int i) { return i == 15; }) && item == 15);
+    std::chrono::milliseconds wait(1);
+    CHECK(queue.WaitAndPop(item, wait) && item == 13);
+    CHECK(queue.Size() == 5);
+    queue.Clear();
+    for (int i = 0; i < 8; ++i)
+    {
+        queue.Push(i);
+    }
+    CHECK(queue.Size() == 8);
+    CHECK(allocations.load() == before);
+
+    // Appending onto a full ring queue makes room first instead of growing
+    ThreadSafeRingQueue<int> source(8);
+    for (int i = 10; i < 15; ++i)
+    {
+        source.Push(i);
+    }
+    before = allocations.load();
+    CHECK(queue.AppendAllItems(source) == 5);
+    CHECK(source.Empty() && queue.Size() == 8);
+    for (int i = 20; i < 28; ++i)
+    {
+        source.Push(i);
+    }
+    CHECK(queue.AppendAllItems(source) == 8);
+    CHECK(allocations.load() == before);
+    CHECK((Drain(queue) == std::vector<int>{20, 21, 22, 23, 24, 25, 26, 27}));
+    CHECK(queue.Dropped() == 12 + 5 + 8);
+}
+
+//***********************************************************************************
+// LockFreeQueue
+//***********************************************************************************
+static void TestLockFreeQueue()
+{
+    printf("LockFreeQueue\n");
+    // Capacity rounds up to a power of two; a full queue drops the oldest
+    LockFreeQueue<int> queue(3);
+    for (int i = 0; i < 6; ++i)
+    {
+        queue.Push(i);
+    }
+    CHECK(queue.Size() == 4);
+    int item = -1;
+    CHECK(queue.TryPop(item) && item == 2);
+
+    // PopIf takes a match from anywhere, rotating the others to the tail
+    CHECK(queue.PopIf(item, [](int i) { return i == 4; }) && item == 4);
+    CHECK(!queue.PopIf(item, [](int i) { return i == 42; }));
+    CHECK(queue.Size() == 2);
+    CHECK(queue.TryPop(item) && item == 5);
+    CHECK(queue.TryPop(item) && item == 3);
+    CHECK(!queue.TryPop(item) && queue.Empty());
+
+    std::chrono::milliseconds timeout(1);
+    CHECK(!queue.WaitAndPop(item, timeout));
+
+    // WaitAndPopIf passes over items that do not match while it waits, and
+    // takes a matching one pushed meanwhile
+    queue.Push(1);
+    std::chrono::milliseconds wait(50);
+    CHECK(!queue.WaitAndPopIf(item, wait, [](int i) { return i == 2; }));
+    CHECK(queue.Size() == 1);
+    std::thread producer([&queue] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        queue.Push(3);
+        queue.Push(2);
+    });
+    wait = std::chrono::seconds(5);
+    CHECK(queue.WaitAndPopIf(item, wait, [](int i) { return i == 2; }) && item == 2);
+    producer.join();
+    CHECK(queue.Size() == 2);
+    queue.Clear();
+
+    bool threw = false;
+    try
+    {
+        LockFreeQueue<int> empty(0);
+    }
+    catch (const std::invalid_argument&)
+    {
+        threw = true;
+    }
+    CHECK(threw);
+
+    // Every item pushed by several producers reaches exactly one of several
+    // consumers, some of them parked
+    const int PRODUCERS = 4;
+    const int CONSUMERS = 4;
+    const int ITEMS = 20000;
+    LockFreeQueue<int> shared(PRODUCERS * ITEMS);
+    std::vector<std::atomic<int>> seen(PRODUCERS * ITEMS);
+    for (std::atomic<int>& count : seen)
+    {
+        count.store(0);
+    }
+    std::atomic<int> popped(0);
+    std::vector<std::thread> threads;
+    for (int c = 0; c < CONSUMERS; ++c)
+    {
+        threads.emplace_back([&] {
+            int value;
+            while (popped.load() < PRODUCERS * ITEMS)
+            {
+                std::chrono::milliseconds wait(10);
+                if (shared.WaitAndPop(value, wait))
+                {
+                    seen[value].fetch_add(1);
+                    popped.fetch_add(1);
+                }
+            }
+        });
+    }
+    for (int p = 0; p < PRODUCERS; ++p)
+    {
+        threads.emplace_back([&shared, p] {
+            for (int i = 0; i < ITEMS; ++i)
+            {
+                shared.Push(p * ITEMS + i);
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    int wrong = 0;
+    for (std::atomic<int>& count : seen)
+    {
+        wrong += count.load() != 1;
+    }
+    CHECK(wrong == 0);
+    CHECK(shared.Empty());
+}
+
+//***********************************************************************************
+// Batch operations
+//***********************************************************************************
+template<typename Queue, typename Container> static void TestBatch(const char* storage)
+{
+    printf("Batch operations, %s storage\n", storage);
+    const int values[] = {0, 1, 2, 3, 4, 5};
+
+    // A bounded queue keeps the newest maxEntries of a batch
+    Queue queue(4);
+    CHECK(queue.PushBatch(std::begin(values), std::end(values)) == 6);
+    CHECK(queue.Size() == 4);
+    int popped[8];
+    CHECK(queue.PopBatch(popped, 3, std::chrono::milliseconds(0)) == 3);
+    CHECK(popped[0] == 2 && popped[1] == 3 && popped[2] == 4);
+    CHECK(queue.PopBatch(popped, 8, std::chrono::milliseconds(0)) == 1 && popped[0] == 5);
+    CHECK(queue.PopBatch(popped, 8, std::chrono::milliseconds(1)) == 0);
+
+    // PopBatch waits for the first item
+    std::thread producer([&queue] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        queue.Push(7);
+    });
+    CHECK(queue.PopBatch(popped, 8, std::chrono::seconds(5)) == 1 && popped[0] == 7);
+    producer.join();
+
+    // PopAll hands over everything, and the queue stays usable
+    Container all;
+    queue.PushBatch(std::begin(values), std::begin(values) + 3);
+    CHECK(queue.PopAll(all) == 3 && queue.Empty());
+    CHECK(all.size() == 3 && all.front() == 0);
+    queue.Push(9);
+    CHECK(Drain(queue) == std::vector<int>{9});
+
+    // Appending onto a bounded queue drops the oldest beyond maxEntries
+    Queue source(4);
+    queue.PushBatch(std::begin(values), std::begin(values) + 2);
+    source.PushBatch(std::begin(values) + 2, std::begin(values) + 5);
+    CHECK(queue.AppendAllItems(source) == 3);
+    CHECK(source.Empty());
+    CHECK((Drain(queue) == std::vector<int>{1, 2, 3, 4}));
+
+    // Appending onto an empty queue, and back again
+    source.PushBatch(std::begin(values), std::begin(values) + 2);
+    CHECK(queue.AppendAllItems(source) == 2);
+    CHECK(source.AppendAllItems(queue) == 2);
+    CHECK((Drain(source) == std::vector<int>{0, 1}));
+
+    // Two queues appending onto each other at once neither deadlock nor
+    // lose items
+    Queue left(0);
+    Queue right(0);
+    left.PushBatch(std::begin(values), std::end(values));
+    std::thread forth([&] {
+        for (int i = 0; i < 10000; ++i)
+        {
+            left.AppendAllItems(right);
+        }
+    });
+    std::thread back([&] {
+        for (int i = 0; i < 10000; ++i)
+        {
+            right.AppendAllItems(left);
+        }
+    });
+    forth.join();
+    back.join();
+    CHECK(left.Size() + right.Size() == 6);
+}
+
+//***********************************************************************************
+// Keyed index
+//***********************************************************************************
+/// @brief Pushes a packet for each sequence number in seqs.
+static void PushSeqs(PacketQueue& queue, const std::vector<uint16_t>& seqs)
+{
+    for (uint16_t seq : seqs)
+    {
+        queue.Push(Packet{seq, "a"});
+    }
+}
+
+/// @brief Checks that the index counts exactly the sequence numbers in
+/// expected, by key and then by draining the queue in order.
+static bool Holds(PacketQueue& queue, const std::vector<uint16_t>& expected)
+{
+    bool ok = true;
+    for (uint16_t seq = 0; seq < 16; ++seq)
+    {
+        ok = ok && queue.Count(seq) == static_cast<size_t>(std::count(expected.begin(), expected.end(), seq));
+    }
+    std::vector<uint16_t> held;
+    Packet packet;
+    while (queue.TryPop(packet))
+    {
+        held.push_back(packet.seqNumber);
+    }
+    for (uint16_t seq = 0; seq < 16; ++seq)
+    {
+        ok = ok && queue.Count(seq) == 0;
+    }
+    return ok && held == expected;
+}
+
+static void TestKeyedIndex()
+{
+    printf("Keyed index\n");
+    Packet packet;
+
+    // Entries trimmed by a bounded queue leave the index
+    PacketQueue queue(4);
+    PushSeqs(queue, {0, 1, 2, 3, 4, 5});
+    CHECK(queue.Count(0) == 0 && queue.Count(1) == 0 && queue.Count(5) == 1);
+    CHECK(Holds(queue, {2, 3, 4, 5}));
+
+    // Removal from the front, the middle and by key, with duplicates
+    PushSeqs(queue, {1, 2, 3, 2});
+    CHECK(queue.Count(2) == 2);
+    CHECK(queue.TryPop(packet) && packet.seqNumber == 1);
+    CHECK(queue.PopIf(packet, [](const Packet& p) { return p.seqNumber == 3; }));
+    CHECK(queue.PopByKey(packet, 2) && packet.seqNumber == 2);
+    CHECK(!queue.PopByKey(packet, 7));
+    CHECK(Holds(queue, {2}));
+
+    // AppendAllItems moves the index entries across, and the trim that
+    // follows it drops those of the items it discards
+    PacketQueue source(0);
+    PushSeqs(queue, {0, 1});
+    PushSeqs(source, {2, 3, 4});
+    CHECK(queue.AppendAllItems(source) == 3);
+    CHECK(source.Count(2) == 0 && source.Count(4) == 0);
+    CHECK(Holds(source, {}));
+    CHECK(Holds(queue, {1, 2, 3, 4}));
+
+    // Into an empty queue, then the batch and bulk removals
+    PushSeqs(source, {5, 6, 7});
+    CHECK(queue.AppendAllItems(source) == 3);
+    Packet popped[2];
+    CHECK(queue.PopBatch(popped, 2, std::chrono::milliseconds(0)) == 2);
+    CHECK(queue.Count(5) == 0 && queue.Count(6) == 0 && queue.Count(7) == 1);
+    std::list<Packet> all;
+    CHECK(queue.PopAll(all) == 1 && queue.Count(7) == 0);
+    PushSeqs(queue, {8, 9});
+    queue.Clear();
+    CHECK(Holds(queue, {}));
+
+    // Any key type, through a custom extractor
+    ThreadSafeQueue<Packet, std::list<Packet>, SourceKey> bySource(0);
+    bySource.Push(Packet{1, "left"});
+    bySource.Push(Packet{2, "right"});
+    bySource.Push(Packet{3, "left"});
+    CHECK(bySource.Count(std::string("left")) == 2);
+    CHECK(bySource.PopByKey(packet, std::string("right")) && packet.seqNumber == 2);
+    CHECK(bySource.Count(std::string("right")) == 0 && bySource.Size() == 2);
+}
+
+//***********************************************************************************
+// Overflow policies
+//***********************************************************************************
+static void TestOverflow()
+{
+    printf("Overflow policies\n");
+    const int values[] = {0, 1, 2, 3, 4, 5};
+
+    IntQueue dropOldest(2);
+    CHECK(dropOldest.Push(0) && dropOldest.Push(1) && dropOldest.Push(2));
+    CHECK(dropOldest.Dropped() == 1 && dropOldest.Rejected() == 0);
+    CHECK((Drain(dropOldest) == std::vector<int>{1, 2}));
+
+    IntQueue dropNewest(2, OverflowPolicy::DropNewest);
+    CHECK(dropNewest.Push(0) && dropNewest.Push(1) && !dropNewest.Push(2));
+    CHECK(dropNewest.PushBatch(std::begin(values), std::end(values)) == 0);
+    CHECK(dropNewest.Dropped() == 7 && dropNewest.Rejected() == 0);
+    CHECK((Drain(dropNewest) == std::vector<int>{0, 1}));
+
+    // A rejected item stays with the caller, even when pushed by move
+    ThreadSafeQueue<std::string, std::list<std::string>, NoKey> reject(1, OverflowPolicy::Reject);
+    CHECK(reject.Push(std::string("first")));
+    std::string kept("kept");
+    CHECK(!reject.Push(std::move(kept)) && kept == "kept");
+    CHECK(reject.Rejected() == 1 && reject.Dropped() == 0);
+
+    // Batches and appends stop at the first item that does not fit
+    IntQueue rejectBatch(4, OverflowPolicy::Reject);
+    CHECK(rejectBatch.PushBatch(std::begin(values), std::begin(values) + 3) == 3);
+    IntQueue source(0);
+    source.PushBatch(std::begin(values) + 3, std::end(values));
+    CHECK(rejectBatch.AppendAllItems(source) == 1);
+    CHECK((Drain(source) == std::vector<int>{4, 5}));
+    CHECK(rejectBatch.PushBatch(std::begin(values), std::end(values)) == 0);
+    CHECK(rejectBatch.Rejected() == 1 && rejectBatch.Dropped() == 0);
+    CHECK((Drain(rejectBatch) == std::vector<int>{0, 1, 2, 3}));
+
+    // Block gives up after its timeout...
+    IntQueue blockTimed(1, OverflowPolicy::Block, std::chrono::milliseconds(20));
+    CHECK(blockTimed.Push(0));
+    auto start = std::chrono::steady_clock::now();
+    CHECK(!blockTimed.Push(1));
+    CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+    CHECK(blockTimed.Rejected() == 1 && blockTimed.Size() == 1);
+
+    // ...or waits until a consumer makes room
+    IntQueue block(1, OverflowPolicy::Block);
+    CHECK(block.Push(0));
+    std::thread consumer([&block] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        int item;
+        block.TryPop(item);
+    });
+    CHECK(block.Push(1));
+    consumer.join();
+    CHECK(block.Rejected() == 0 && (Drain(block) == std::vector<int>{1}));
+
+    // Watermarks fire once per crossing, with hysteresis between them
+    IntQueue marked(0);
+    std::vector<size_t> highs;
+    std::vector<size_t> lows;
+    marked.SetWatermarks(3, 1,
+                         [&highs](size_t size) { highs.push_back(size); },
+                         [&lows](size_t size) { lows.push_back(size); });
+    marked.PushBatch(std::begin(values), std::begin(values) + 4);
+    CHECK((highs == std::vector<size_t>{3}) && lows.empty());
+    int item;
+    marked.TryPop(item);
+    marked.TryPop(item);
+    CHECK(lows.empty());
+    marked.Push(9);
+    CHECK(highs.size() == 1);
+    marked.TryPop(item);
+    CHECK(lows.empty());
+    marked.TryPop(item);
+    CHECK((lows == std::vector<size_t>{1}));
+    marked.Push(9);
+    marked.Push(9);
+    CHECK((highs == std::vector<size_t>{3, 3}));
+    marked.Clear();
+    CHECK((lows == std::vector<size_t>{1, 0}));
+
+    // Making room for an append reports only the size it ends at
+    IntQueue spliced(8);
+    highs.clear();
+    lows.clear();
+    spliced.SetWatermarks(6, 2,
+                          [&highs](size_t size) { highs.push_back(size); },
+                          [&lows](size_t size) { lows.push_back(size); });
+    for (int i = 0; i < 7; ++i)
+    {
+        spliced.Push(i);
+    }
+    for (int i = 10; i < 18; ++i)
+    {
+        source.Push(i);
+    }
+    CHECK(spliced.AppendAllItems(source) == 8);
+    CHECK((highs == std::vector<size_t>{6}) && lows.empty());
+    CHECK(spliced.Size() == 8 && spliced.Dropped() == 7);
+}
+
+//***********************************************************************************
+// Main
+//***********************************************************************************
+int main()
+{
+    TestRingStorage();
+    TestLockFreeQueue();
+    TestBatch<IntQueue, std::list<int>>("list");
+    TestBatch<ThreadSafeRingQueue<int>, RingBuffer<int>>("ring");
+    TestKeyedIndex();
+    TestOverflow();
+
+    if (failures)
+    {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All queue checks passed\n");
+    return 0;
+}